@@ -0,0 +1,54 @@
+#ifndef WGPU_PS_ALLOCATIONCOUNTER_H
+#define WGPU_PS_ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+//Debug helper to prove that a piece of code does not touch the heap. It is only active when
+//WGPU_PS_CHECK_ALLOCATIONS is defined (debug builds): then every operator new is counted per
+//thread, and Eigen is built with EIGEN_RUNTIME_NO_MALLOC so its own mallocs can be forbidden.
+class AllocationCounter {
+public:
+    //Number of operator new calls made so far by the calling thread
+    static std::size_t count();
+};
+
+//Asserts that no allocation happens on the calling thread while the guard is alive. Eigen's
+//malloc switch is global to the process rather than per thread, so it is only thrown when
+//forbidEigenMalloc is set, that is, when no other thread may use Eigen while the guard is alive.
+class NoAllocationScope {
+public:
+#ifdef WGPU_PS_CHECK_ALLOCATIONS
+    explicit NoAllocationScope(bool forbidEigenMalloc = true);
+
+    ~NoAllocationScope();
+
+private:
+    std::size_t startCount;
+    bool eigenMallocAllowed;
+#else
+    explicit NoAllocationScope(bool = true) {}
+
+    ~NoAllocationScope() {}
+#endif
+};
+
+//Lifts an enclosing NoAllocationScope for code that is known to allocate, such as Eigen's sparse
+//factorizations. The allocations made while it is alive are not counted.
+class AllocationAllowedScope {
+public:
+#ifdef WGPU_PS_CHECK_ALLOCATIONS
+    AllocationAllowedScope();
+
+    ~AllocationAllowedScope();
+
+private:
+    std::size_t startCount;
+    bool eigenMallocAllowed;
+#else
+    AllocationAllowedScope() {}
+
+    ~AllocationAllowedScope() {}
+#endif
+};
+
+#endif //WGPU_PS_ALLOCATIONCOUNTER_H
@@ -0,0 +1,95 @@
+#ifndef WGPU_PS_BLOCKSPARSEMATRIX_H
+#define WGPU_PS_BLOCKSPARSEMATRIX_H
+
+#include <threadPool.h>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+
+class BlockSparseMatrix;
+
+namespace Eigen {
+    namespace internal {
+        //Behaves as a sparse matrix for Eigen, so it can be used by the iterative solvers
+        template<>
+        struct traits<BlockSparseMatrix> : public Eigen::internal::traits<Eigen::SparseMatrix<float>> {};
+    }
+}
+
+//Block compressed sparse row matrix made of 3x3 blocks, one per pair of coupled nodes. It stores a
+//column index per block instead of per value, so its products read far less index data than a
+//scalar sparse matrix. The symmetric variant only stores the blocks on and above the diagonal.
+//Products run in parallel over chunks of block rows, and each block row is only written by its own
+//task.
+class BlockSparseMatrix : public Eigen::EigenBase<BlockSparseMatrix> {
+public:
+    typedef float Scalar;
+    typedef float RealScalar;
+    typedef int StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic,
+        IsRowMajor = false
+    };
+
+    //The blocks of block row i are [rowOffsets[i], rowOffsets[i + 1]). Each block stores its
+    //9 values row by row.
+    std::vector<int> rowOffsets;
+    std::vector<int> blockCols;
+    std::vector<float> values;
+    bool symmetric = false;
+
+    Eigen::Index rows() const { return 3 * numBlockRows(); }
+
+    Eigen::Index cols() const { return 3 * numBlockRows(); }
+
+    int numBlockRows() const { return rowOffsets.empty() ? 0 : (int) rowOffsets.size() - 1; }
+
+    int numBlocks() const { return (int) blockCols.size(); }
+
+    //Build the block pattern covering every entry of m. With upperOnly the matrix is taken as
+    //symmetric and only the blocks on and above the diagonal are kept. Products run on pool.
+    void setPattern(const SparseMatrixR &m, bool upperOnly, ThreadPool &pool);
+
+    //Copy the values of m, which must have the pattern given to setPattern()
+    void setValues(const SparseMatrixR &m);
+
+    //y += alpha * A * x
+    void multiply(const float* x, float* y, float alpha) const;
+
+    template<typename Rhs>
+    Eigen::Product<BlockSparseMatrix, Rhs, Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs> &x) const {
+        return Eigen::Product<BlockSparseMatrix, Rhs, Eigen::AliasFreeProduct>(*this, x.derived());
+    }
+
+private:
+    //Position in values of each stored entry of the scalar matrix, -1 if it is not stored
+    std::vector<int> valueMap;
+    //Symmetric variant: the blocks below the diagonal of block row i are the transposes of the
+    //stored blocks lowerBlocks[lowerOffsets[i]..lowerOffsets[i + 1]), which sit in block rows lowerRows
+    std::vector<int> lowerOffsets;
+    std::vector<int> lowerBlocks;
+    std::vector<int> lowerRows;
+    ThreadPool* threadPool = nullptr;
+};
+
+namespace Eigen {
+    namespace internal {
+        template<typename Rhs>
+        struct generic_product_impl<BlockSparseMatrix, Rhs, SparseShape, DenseShape, GemvProduct>
+                : generic_product_impl_base<BlockSparseMatrix, Rhs, generic_product_impl<BlockSparseMatrix, Rhs>> {
+
+            template<typename Dest>
+            static void scaleAndAddTo(Dest &dst, const BlockSparseMatrix &lhs, const Rhs &rhs, const float &alpha) {
+                Eigen::Ref<const VectorXR> x(rhs);
+                Eigen::Ref<VectorXR> y(dst);
+                lhs.multiply(x.data(), y.data(), alpha);
+            }
+        };
+    }
+}
+
+#endif //WGPU_PS_BLOCKSPARSEMATRIX_H
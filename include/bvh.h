@@ -0,0 +1,122 @@
+#ifndef WGPU_PS_BVH_H
+#define WGPU_PS_BVH_H
+
+#include <object.h>
+#include <threadPool.h>
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Bounding volume hierarchy over the triangles of a mesh. It is built from the Morton codes of the
+//triangle centers as a binary radix tree (Karras 2012), whose internal nodes can all be built in
+//parallel. When the mesh deforms the tree is refitted bottom-up instead of rebuilt, and rebuilt only
+//once the refitted boxes have grown too much. After the first build nothing allocates.
+class TriangleBVH{
+public:
+    struct RayHit {
+        float t;
+        int triangle;
+        //Barycentric coordinates of the hit point along the second and third triangle vertices
+        float u;
+        float v;
+    };
+
+    //Rebuild when the total surface of the internal boxes grows past this factor of its value at the last build
+    float rebuildThreshold = 2.0f;
+
+    //Build the tree over the given triangles (3 node indices each) at positions
+    void build(const Eigen::Ref<const VectorXR>& positions, const Vectori& triangles, ThreadPool& pool);
+
+    //Build the tree again for the same triangles at new positions
+    void rebuild(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool);
+
+    //Update the boxes to new positions, keeping the tree
+    void refit(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool);
+
+    //Refit, and rebuild if the quality has degraded. Returns true if the tree was rebuilt.
+    bool update(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool);
+
+    //Same as the above, with the boxes bounding the triangles over a linear motion from start to end
+    void rebuild(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end, ThreadPool& pool);
+
+    void refit(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end, ThreadPool& pool);
+
+    bool update(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end, ThreadPool& pool);
+
+    //Closest hit along origin + t * direction for t in [0, maxT]
+    bool raycast(const Eigen::Ref<const VectorXR>& positions, const Eigen::Vector3f& origin,
+                 const Eigen::Vector3f& direction, float maxT, RayHit& hit) const;
+
+    //Call visit(triangle) for every triangle whose box overlaps [lo, hi]
+    template<typename F>
+    void queryBox(const Eigen::Vector3f& lo, const Eigen::Vector3f& hi, const F& visit) const {
+        if (numTriangles == 0)
+            return;
+        int stack[MaxDepth];
+        int top = 0;
+        stack[top++] = root();
+        while (top > 0) {
+            int node = stack[--top];
+            const float* box = &bounds[6 * node];
+            if (lo[0] > box[3] || lo[1] > box[4] || lo[2] > box[5] || hi[0] < box[0] || hi[1] < box[1] || hi[2] < box[2])
+                continue;
+            if (isLeaf(node)) {
+                visit(leafTriangles[node - (numTriangles - 1)]);
+            } else {
+                stack[top++] = left[node];
+                stack[top++] = right[node];
+            }
+        }
+    }
+
+    int size() const { return numTriangles; }
+
+    //Surface of the internal boxes relative to the last build, and number of builds so far
+    float quality() const { return builtArea > 0.0f ? currentArea / builtArea : 1.0f; }
+
+    int numBuilds() const { return builds; }
+
+    const std::vector<int>& getTriangles() const { return triangles; }
+
+private:
+    //Bound of the tree depth and traversal stacks: the keys have 64 bits (code and triangle index)
+    static constexpr int MaxDepth = 96;
+
+    int numTriangles = 0;
+    int builds = 0;
+    float builtArea = 0.0f;
+    float currentArea = 0.0f;
+    std::vector<int> triangles;
+
+    //Internal nodes are [0, n - 1) and leaves [n - 1, 2n - 1), leaf k holding triangle leafTriangles[k].
+    //Each node stores its box as (min, max).
+    std::vector<float> bounds;
+    std::vector<int> left;
+    std::vector<int> right;
+    std::vector<int> leafTriangles;
+
+    //Morton codes with the triangle index in the low bits, sorted to order the leaves
+    std::vector<std::uint64_t> keys;
+    std::vector<float> chunkBounds;
+    std::vector<float> chunkArea;
+
+    //Internal nodes grouped by depth, so each level can be refitted in parallel after the deeper ones
+    std::vector<int> levelStart;
+    std::vector<int> levelNodes;
+
+    int root() const { return numTriangles > 1 ? 0 : numTriangles - 1; }
+
+    bool isLeaf(int node) const { return node >= numTriangles - 1; }
+
+    int commonPrefix(int i, int j) const;
+
+    void buildInternalNode(int i);
+
+    void computeLevels();
+
+    void refitLeaves(const float* start, const float* end, ThreadPool& pool);
+};
+
+#endif //WGPU_PS_BVH_H
@@ -0,0 +1,161 @@
+#ifndef WGPU_PS_COLLISIONUTILS_H
+#define WGPU_PS_COLLISIONUTILS_H
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <vector>
+
+//Helpers shared by the collision passes of the cloth
+
+//Candidates tested together by a narrowphase, one per lane of the array expressions
+constexpr int Batch = 16;
+using BatchArray = Eigen::Array<float, Batch, 1>;
+using BatchVectors = Eigen::Array<float, Batch, 3>;
+using BatchMask = Eigen::Array<bool, Batch, 1>;
+
+//Triangles or edges per task of the broadphases, and candidates per task of the narrowphases. The
+//candidate grain is a multiple of Batch.
+constexpr int PrimitiveGrain = 256;
+constexpr int CandidateGrain = 256;
+
+inline BatchArray dot(const BatchVectors& a, const BatchVectors& b) {
+    return a.col(0) * b.col(0) + a.col(1) * b.col(1) + a.col(2) * b.col(2);
+}
+
+inline BatchVectors cross(const BatchVectors& a, const BatchVectors& b) {
+    BatchVectors c;
+    c.col(0) = a.col(1) * b.col(2) - a.col(2) * b.col(1);
+    c.col(1) = a.col(2) * b.col(0) - a.col(0) * b.col(2);
+    c.col(2) = a.col(0) * b.col(1) - a.col(1) * b.col(0);
+    return c;
+}
+
+//Barycentric coordinates of the projection of p on the plane of the triangle abc
+inline void triangleBarycentric(const BatchVectors& p, const BatchVectors& a, const BatchVectors& b,
+                                const BatchVectors& c, BatchArray& wa, BatchArray& wb, BatchArray& wc) {
+    BatchVectors e0 = b - a;
+    BatchVectors e1 = c - a;
+    BatchVectors r = p - a;
+    BatchArray d00 = dot(e0, e0);
+    BatchArray d01 = dot(e0, e1);
+    BatchArray d11 = dot(e1, e1);
+    BatchArray d20 = dot(r, e0);
+    BatchArray d21 = dot(r, e1);
+    BatchArray denom = (d00 * d11 - d01 * d01).max(1e-20f);
+    wb = (d11 * d20 - d01 * d21) / denom;
+    wc = (d00 * d21 - d01 * d20) / denom;
+    wa = 1.0f - wb - wc;
+}
+
+//Closest points a + s * (b - a) and c + t * (d - c) of the segments ab and cd, with the clamping
+//written as selects
+inline void segmentClosestPoints(const BatchVectors& a, const BatchVectors& b, const BatchVectors& c,
+                                 const BatchVectors& d, BatchArray& s, BatchArray& t) {
+    BatchVectors d1 = b - a;
+    BatchVectors d2 = d - c;
+    BatchVectors r = a - c;
+    BatchArray aa = dot(d1, d1).max(1e-20f);
+    BatchArray ee = dot(d2, d2).max(1e-20f);
+    BatchArray bb = dot(d1, d2);
+    BatchArray cc = dot(d1, r);
+    BatchArray ff = dot(d2, r);
+    BatchArray denom = aa * ee - bb * bb;
+    s = (denom > 1e-6f * aa * ee).select(((bb * ff - cc * ee) / denom.max(1e-20f)).max(0.0f).min(1.0f), 0.0f);
+    t = (bb * s + ff) / ee;
+    BatchArray sLow = (-cc / aa).max(0.0f).min(1.0f);
+    BatchArray sHigh = ((bb - cc) / aa).max(0.0f).min(1.0f);
+    s = (t < 0.0f).select(sLow, (t > 1.0f).select(sHigh, s));
+    t = t.max(0.0f).min(1.0f);
+}
+
+//Closest point to p on the triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+inline Eigen::Vector3f closestPointOnTriangle(const Eigen::Vector3f& p, const Eigen::Vector3f& a,
+                                              const Eigen::Vector3f& b, const Eigen::Vector3f& c) {
+    Eigen::Vector3f ab = b - a;
+    Eigen::Vector3f ac = c - a;
+    Eigen::Vector3f ap = p - a;
+    float d1 = ab.dot(ap);
+    float d2 = ac.dot(ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+
+    Eigen::Vector3f bp = p - b;
+    float d3 = ab.dot(bp);
+    float d4 = ac.dot(bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + d1 / (d1 - d3) * ab;
+
+    Eigen::Vector3f cp = p - c;
+    float d5 = ab.dot(cp);
+    float d6 = ac.dot(cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + d2 / (d2 - d6) * ac;
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);
+
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+//Velocity relative to a surface after touching it with normal n: the part moving into it is removed,
+//and Coulomb friction takes up to friction times that part from the tangential one
+inline Eigen::Vector3f contactVelocity(const Eigen::Vector3f& v, const Eigen::Vector3f& n, float friction) {
+    float vn = v.dot(n);
+    if (vn >= 0.0f)
+        return v;
+    Eigen::Vector3f vt = v - vn * n;
+    float vtNorm = vt.norm();
+    float keep = vtNorm > 0.0f ? std::max(0.0f, 1.0f + friction * vn / vtNorm) : 0.0f;
+    return keep * vt;
+}
+
+//Node state of a batch of candidates acting on 4 nodes each, one array row per candidate. Lanes past
+//count repeat the last candidate, so every lane computes valid numbers.
+struct CandidateBatch {
+    BatchVectors x[4];
+    BatchVectors v[4];
+    BatchArray massInv[4];
+
+    CandidateBatch(const int* nodes, int count, const float* pos, const float* vel, const float* nodeMassInv) {
+        for (int lane = 0; lane < Batch; lane++) {
+            const int* candidate = nodes + 4 * std::min(lane, count - 1);
+            for (int k = 0; k < 4; k++) {
+                x[k].row(lane) = Eigen::Map<const Eigen::Array<float, 1, 3>>(pos + 3 * candidate[k]);
+                v[k].row(lane) = Eigen::Map<const Eigen::Array<float, 1, 3>>(vel + 3 * candidate[k]);
+                massInv[k][lane] = nodeMassInv[candidate[k]];
+            }
+        }
+    }
+};
+
+//Sort the items 0..n-1 by key into sorted. Bucket k ends up as [start[k], start[k + 1]).
+inline void countingSort(const int* keys, int n, std::vector<int>& start, int* sorted) {
+
+    std::fill(start.begin(), start.end(), 0);
+    for (int i = 0; i < n; i++)
+        start[keys[i]]++;
+    int sum = 0;
+    for (int& bucket: start) {
+        int count = bucket;
+        bucket = sum;
+        sum += count;
+    }
+    //Scattering moves each bucket start to its end, which is the start of the next one
+    for (int i = 0; i < n; i++)
+        sorted[start[keys[i]]++] = i;
+    for (int k = (int) start.size() - 1; k > 0; k--)
+        start[k] = start[k - 1];
+    start[0] = 0;
+}
+
+#endif //WGPU_PS_COLLISIONUTILS_H
@@ -0,0 +1,85 @@
+#ifndef WGPU_PS_CONJUGATEGRADIENT_H
+#define WGPU_PS_CONJUGATEGRADIENT_H
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Preconditioned conjugate gradient with persistent work vectors. It follows
+//Eigen::ConjugateGradient, and takes the same operators (sparse matrices or custom
+//Eigen operators) and preconditioners, but it does not allocate once it has been resized.
+class ConjugateGradientSolver {
+public:
+    float tolerance = 1e-4f;
+    int maxIterations = 200;
+
+    void resize(int n) {
+        if (residual.size() == n)
+            return;
+        residual.resize(n);
+        direction.resize(n);
+        precResidual.resize(n);
+        product.resize(n);
+    }
+
+    int iterations() const { return lastIterations; }
+
+    float error() const { return lastError; }
+
+    //Solve A * x = b, using the value of x as initial guess.
+    template<typename Operator, typename Preconditioner>
+    bool solve(const Operator &A, const Preconditioner &precond, const VectorXR &b, Eigen::Ref<VectorXR> x) {
+        resize((int) b.size());
+
+        product.noalias() = A * x;
+        residual = b - product;
+
+        float rhsNorm2 = b.squaredNorm();
+        lastIterations = 0;
+        if (rhsNorm2 == 0.0f) {
+            x.setZero();
+            lastError = 0.0f;
+            return true;
+        }
+        float threshold = std::max(tolerance * tolerance * rhsNorm2, std::numeric_limits<float>::min());
+        float residualNorm2 = residual.squaredNorm();
+
+        if (residualNorm2 >= threshold) {
+            direction = precond.solve(residual);
+            float absNew = residual.dot(direction);
+
+            while (lastIterations < maxIterations) {
+                product.noalias() = A * direction;
+                float alpha = absNew / direction.dot(product);
+                x += alpha * direction;
+                residual -= alpha * product;
+                lastIterations++;
+
+                residualNorm2 = residual.squaredNorm();
+                if (residualNorm2 < threshold)
+                    break;
+
+                precResidual = precond.solve(residual);
+                float absOld = absNew;
+                absNew = residual.dot(precResidual);
+                direction = precResidual + (absNew / absOld) * direction;
+            }
+        }
+
+        lastError = std::sqrt(residualNorm2 / rhsNorm2);
+        return residualNorm2 < threshold;
+    }
+
+private:
+    VectorXR residual;
+    VectorXR direction;
+    VectorXR precResidual;
+    VectorXR product;
+    int lastIterations = 0;
+    float lastError = 0.0f;
+};
+
+#endif //WGPU_PS_CONJUGATEGRADIENT_H
@@ -0,0 +1,108 @@
+#ifndef WGPU_PS_CONTINUOUSCOLLISION_H
+#define WGPU_PS_CONTINUOUSCOLLISION_H
+
+#include <bvh.h>
+#include <object.h>
+#include <threadPool.h>
+#include <Eigen/Dense>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Continuous cloth self-collision. The nodes are taken to move in a straight line from pos - h * vel to
+//pos over a step, and the vertex-triangle and edge-edge pairs that become coplanar in between (the
+//roots of a cubic in time) at a point where they touch are stopped with inelastic impulses. Detection
+//and response are repeated until no pair crosses or the iterations run out, so large steps cannot
+//tunnel through the cloth. The nodes of the pairs still crossing after that are stopped at their start
+//position, which cannot cross if the start state did not. The candidates come from a BVH whose boxes
+//bound the triangles over the step.
+class ContinuousCollision{
+public:
+    //Separation left between the primitives of a stopped pair, as a fraction of the mean rest edge length
+    float gapScale = 0.05f;
+    //Detection and response passes per step, before stopping the nodes that still cross
+    int iterations = 16;
+    //Room of the fixed candidate buffers, set in initialize(): pairs per vertex or edge, averaged over the
+    //primitives of a task
+    int candidatesPerPrimitive = 12;
+
+    //Candidate pairs and crossing pairs found by the last pass, passes run in the last step and nodes
+    //stopped by it
+    int lastCandidates = 0;
+    int lastCollisions = 0;
+    int lastIterations = 0;
+    int lastStoppedNodes = 0;
+    //Candidate pairs of the last pass that did not fit in the buffers and were dropped
+    int lastDroppedCandidates = 0;
+
+    //Build the edges and the BVH for a mesh at its rest positions
+    void initialize(const VectorXR& positions, const Vectori& triangles, ThreadPool& pool);
+
+    //Stop the crossings of the step of h seconds that ended at pos, correcting velocities and positions
+    //in place. nodeMassInv holds the inverse mass of each node, zero for fixed nodes.
+    void solve(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv, float h,
+               ThreadPool& pool);
+
+    float getGap() const { return gap; }
+
+private:
+    int numNodes = 0;
+    int numTriangles = 0;
+    int numEdges = 0;
+    //Node indices, 3 per triangle and 2 per edge. The edges of each triangle, and the first triangle of
+    //each edge, which is the one that reports the edge in the broadphase.
+    std::vector<int> triangles;
+    std::vector<int> edges;
+    std::vector<int> triangleEdges;
+    std::vector<int> edgeTriangle;
+    float gap = 0.0f;
+
+    //Positions at the start of the step, and bounds of the edges over the step
+    VectorXR startPos;
+    std::vector<float> edgeBounds;
+    TriangleBVH bvh;
+    //Inverse masses with the stopped nodes fixed, and the number stopped by each task
+    VectorXR stoppedMassInv;
+    std::vector<int> chunkStopped;
+
+    //Candidate pairs found by each task of the broadphase. The buffers have a fixed room, and the pairs
+    //a task finds past it are dropped.
+    std::vector<std::vector<int>> vertexChunkPairs;
+    std::vector<std::vector<int>> edgeChunkPairs;
+    std::vector<int> vertexChunkCounts;
+    std::vector<int> edgeChunkCounts;
+
+    //Every candidate acts on 4 nodes: a vertex and a triangle, or two edges, the vertex-triangle ones
+    //first. For the crossing ones the narrowphase stores the weights of the nodes at the contact point,
+    //the contact normal and the impulse that stops them (zero for the others).
+    int numVertexTriangle = 0;
+    int numCandidates = 0;
+    std::vector<int> candidateNodes;
+    std::vector<float> candidateWeights;
+    std::vector<float> candidateNormals;
+    std::vector<float> candidateImpulses;
+    std::vector<int> chunkCollisions;
+
+    //Candidate slots touching each node, [nodeStart[i], nodeStart[i + 1])
+    std::vector<int> nodeStart;
+    std::vector<int> nodeEntries;
+
+    void findCandidates(const float* pos, ThreadPool& pool);
+
+    void gatherCandidates();
+
+    void computeImpulses(const float* vel, const float* massInv, float h, ThreadPool& pool);
+
+    void vertexTriangleBatch(int begin, int count, const float* vel, const float* massInv, float h);
+
+    void edgeEdgeBatch(int begin, int count, const float* vel, const float* massInv, float h);
+
+    void applyImpulses(float* pos, float* vel, const float* massInv, float h, ThreadPool& pool);
+
+    void stopNodes(float* pos, float* vel, ThreadPool& pool);
+
+    void detect(const Eigen::Ref<const VectorXR>& pos, const float* vel, const float* massInv, float h,
+                ThreadPool& pool);
+};
+
+#endif //WGPU_PS_CONTINUOUSCOLLISION_H
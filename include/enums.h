@@ -7,6 +7,28 @@ enum Integration
     Explicit = 0,
     Symplectic = 1,
     Implicit = 2,
+    ImplicitMatrixFree = 3,
+    //Implicit stiff forces (stretch springs), explicit everything else
+    IMEX = 4,
+    //Explicit family, along with Explicit (forward Euler) and Symplectic (symplectic Euler)
+    VelocityVerlet = 5,
+    RK4 = 6,
+};
+
+enum LinearSolver{
+    IterativeCG = 0,
+    DirectLDLT = 1
+};
+
+enum PreconditionerType{
+    DiagonalPrecond = 0,
+    BlockJacobiPrecond = 1,
+    //Eigen's incomplete factorization allocates at every step, so it is never picked by AutoPrecond
+    IncompleteCholeskyPrecond = 2,
+    GaussSeidelPrecond = 3,
+    MultigridPrecond = 4,
+    //Pick one of the allocation-free preconditioners from the size of the system in initialize()
+    AutoPrecond = 5
 };
 
 enum SpringType{
@@ -14,4 +36,19 @@ enum SpringType{
     Bend = 1
 };
 
+enum ConstraintSolver{
+    GaussSeidel = 0,
+    Jacobi = 1
+};
+
+enum Acceleration{
+    NoAcceleration = 0,
+    Chebyshev = 1,
+    Anderson = 2
+};
+
+enum SimulationCommand{
+    TogglePause = 0
+};
+
 #endif //WGPU_PS_ENUMS_H
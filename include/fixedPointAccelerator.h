@@ -0,0 +1,72 @@
+#ifndef WGPU_PS_FIXEDPOINTACCELERATOR_H
+#define WGPU_PS_FIXEDPOINTACCELERATOR_H
+
+#include <enums.h>
+#include <Eigen/Dense>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
+
+//Convergence acceleration for fixed point iterations q <- G(q), such as the constraint passes of
+//XPBD or the local/global iterations of Projective Dynamics. The solver calls begin() with the
+//initial guess and apply() after every iteration, which replaces G(q) by the accelerated iterate.
+//Whenever an accelerated iteration makes the update grow, the accelerator falls back to the plain
+//iterate and restarts. All the buffers are sized in resize(), so iterating does not allocate.
+class FixedPointAccelerator {
+public:
+    static constexpr int MaxHistory = 8;
+
+    Acceleration method = Acceleration::NoAcceleration;
+
+    //Chebyshev: plain iterations used to estimate the spectral radius before accelerating, and
+    //under-relaxation of the iterates
+    int chebyshevDelay = 5;
+    float underRelaxation = 0.9f;
+
+    //Anderson: number of previous iterates combined, at most MaxHistory
+    int andersonHistory = 5;
+
+    //An iteration diverges when its update is more than this factor larger than the previous one
+    float divergenceFactor = 1.5f;
+
+    void resize(int n);
+
+    void begin(const Eigen::Ref<const VectorXR> &q);
+
+    void apply(Eigen::Ref<VectorXR> q);
+
+    //Spectral radius estimated by the Chebyshev iterations, kept across steps
+    float spectralRadius() const { return rho; }
+
+    //Number of divergence fallbacks since the last begin()
+    int fallbacks() const { return numFallbacks; }
+
+private:
+    void applyChebyshev(Eigen::Ref<VectorXR> q, float updateNorm);
+
+    void applyAnderson(Eigen::Ref<VectorXR> q, float updateNorm);
+
+    int iteration = 0;
+    int numFallbacks = 0;
+    float lastUpdateNorm = 0.0f;
+
+    //Iterates k and k - 1
+    VectorXR previous;
+    VectorXR beforePrevious;
+
+    //Chebyshev state
+    float rho = 0.0f;
+    float omega = 1.0f;
+    int chebyshevStart = 0;
+
+    //Anderson state: differences of the residuals G(q) - q and of the images G(q), as a ring buffer
+    VectorXR residual;
+    VectorXR previousResidual;
+    VectorXR previousImage;
+    MatrixXR residualDiffs;
+    MatrixXR imageDiffs;
+    int historySize = 0;
+    int historyNext = 0;
+};
+
+#endif //WGPU_PS_FIXEDPOINTACCELERATOR_H
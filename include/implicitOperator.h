@@ -0,0 +1,99 @@
+#ifndef WGPU_PS_IMPLICITOPERATOR_H
+#define WGPU_PS_IMPLICITOPERATOR_H
+
+#include <simulable.h>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+class ImplicitOperator;
+
+namespace Eigen {
+    namespace internal {
+        //Behaves as a sparse matrix for Eigen, so it can be used by the iterative solvers
+        template<>
+        struct traits<ImplicitOperator> : public Eigen::internal::traits<Eigen::SparseMatrix<float>> {};
+    }
+}
+
+//Matrix free system matrix of the implicit integrator, M - h * (h * dFdx + dFdv). Its products
+//only call Simulable::applyForceJacobian(), so the jacobians are never assembled. The rows of
+//the fixed DoFs are identity rows.
+class ImplicitOperator : public Eigen::EigenBase<ImplicitOperator> {
+public:
+    typedef float Scalar;
+    typedef float RealScalar;
+    typedef int StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic,
+        IsRowMajor = false
+    };
+
+    Eigen::Index rows() const { return jacobianProduct.size(); }
+
+    Eigen::Index cols() const { return jacobianProduct.size(); }
+
+    template<typename Rhs>
+    Eigen::Product<ImplicitOperator, Rhs, Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs> &x) const {
+        return Eigen::Product<ImplicitOperator, Rhs, Eigen::AliasFreeProduct>(*this, x.derived());
+    }
+
+    void resize(int n) { jacobianProduct.resize(n); }
+
+    void set(const std::vector<Simulable*> &simulables, const VectorXR &m, const std::vector<int> &fixed, float step) {
+        sims = &simulables;
+        mass = &m;
+        fixedDoFs = &fixed;
+        h = step;
+    }
+
+    //dst += alpha * A * x
+    void apply(const Eigen::Ref<const VectorXR> &x, Eigen::Ref<VectorXR> dst, float alpha) const {
+        jacobianProduct.setZero();
+        for (Simulable* sim: *sims)
+            sim->applyForceJacobian(x, jacobianProduct, h);
+
+        for (int dof: *fixedDoFs)
+            jacobianProduct[dof] = ((*mass)[dof] - 1.0f) * x[dof] / h;
+        dst += alpha * (mass->cwiseProduct(x) - h * jacobianProduct);
+    }
+
+private:
+    const std::vector<Simulable*>* sims = nullptr;
+    const VectorXR* mass = nullptr;
+    const std::vector<int>* fixedDoFs = nullptr;
+    float h = 0.0f;
+    mutable VectorXR jacobianProduct;
+};
+
+//Preconditioner that only needs the lumped mass: the inverse mass is zero for fixed DoFs, so
+//the search directions never move them.
+class MassPreconditioner {
+public:
+    void set(const VectorXR &inverseMass) { massInv = &inverseMass; }
+
+    template<typename Rhs>
+    auto solve(const Eigen::MatrixBase<Rhs> &r) const { return massInv->cwiseProduct(r.derived()); }
+
+private:
+    const VectorXR* massInv = nullptr;
+};
+
+namespace Eigen {
+    namespace internal {
+        template<typename Rhs>
+        struct generic_product_impl<ImplicitOperator, Rhs, SparseShape, DenseShape, GemvProduct>
+                : generic_product_impl_base<ImplicitOperator, Rhs, generic_product_impl<ImplicitOperator, Rhs>> {
+
+            template<typename Dest>
+            static void scaleAndAddTo(Dest &dst, const ImplicitOperator &lhs, const Rhs &rhs, const float &alpha) {
+                lhs.apply(rhs, dst, alpha);
+            }
+        };
+    }
+}
+
+#endif //WGPU_PS_IMPLICITOPERATOR_H
@@ -2,7 +2,11 @@
 #define WGPU_PS_MASSSPRING_H
 
 #include <spring.h>
+#include <selfCollision.h>
+#include <continuousCollision.h>
+#include <bvh.h>
 #include <simulable.h>
+#include <physicmanager.h>
 #include <object.h>
 #include <structs.h>
 #include <unordered_set>
@@ -14,8 +18,33 @@ using Vector3R = Eigen::Matrix<float, 3, 1>;
 class MassSpring : public Simulable{
 public:
 
-    std::vector<Node> nodes;
-    std::vector<Spring> springs;
+    //Node state, stored as one contiguous array per attribute (structure of arrays).
+    //Positions and velocities are views onto this simulable's segment of the global state.
+    Eigen::Map<VectorXR> pos{nullptr, 0};
+    Eigen::Map<VectorXR> vel{nullptr, 0};
+    VectorXR nodeMass;
+    VectorXR nodeMassInv;
+    VectorXR nodeDamping;
+    int numNodes{};
+
+    SpringSet springs;
+
+    //Self-collision, set up in initialize() if enabled
+    bool selfCollision{false};
+    SelfCollision collisions;
+    //Continuous self-collision over the motion of each step, run after the other contacts
+    bool continuousCollision{false};
+    ContinuousCollision continuousCollisions;
+    //Distance kept from the obstacles of the manager and from the other cloths
+    float obstacleThickness{0.01f};
+    //Keep a BVH over the triangles up to date after every step, for ray and proximity queries
+    bool trackBVH{false};
+    TriangleBVH bvh;
+    //Collide with the other MassSpring cloths that have it enabled, when the broadphase of the manager
+    //finds their bounds overlapping. The nodes are tested against the BVH of the other cloth, so both
+    //keep theirs up to date as with trackBVH.
+    bool objectCollision{false};
+    float objectFriction{0.3f};
 
     float mass{};
     float stiffnessStretch{};
@@ -33,27 +62,37 @@ public:
 
     int getNumDoFs() override;
 
-    void getPosition(VectorXR& position) override;
+    void bindState(VectorXR& x, VectorXR& v) override;
 
-    void setPosition(VectorXR& position) override;
+    void updateState() override;
 
-    void getVelocity(VectorXR& velocity) override;
+    void getFore(VectorXR& force) override;
 
-    void setVelocity(VectorXR& velocity) override;
+    void getForceJacobianPattern(std::vector<TripletR>& pattern) override;
 
-    void getFore(VectorXR& force) override;
+    void getForceJacobian(SparseMatrixR& dFdx, SparseMatrixR& dFdv) override;
+
+    void applyForceJacobian(const Eigen::Ref<const VectorXR>& dv, VectorXR& out, float h) override;
+
+    void getStiffForceJacobianPattern(std::vector<TripletR>& pattern) override;
+
+    void getStiffForceJacobian(SparseMatrixR& dFdx) override;
+
+    float getMaxStiffnessMassRatio(bool excludeStiff) override;
+
+    void solveCollisions(float h) override;
 
-    void getForceJacobian(MatrixXR& dFdx, MatrixXR& dFdv) override;
+    void solveObjectCollisions(Simulable& other, float h) override;
 
-    void getMass(MatrixXR& m) override;
+    void getMass(VectorXR& m) override;
 
-    void getMassInverse(MatrixXR& massInv) override;
+    void getMassInverse(VectorXR& massInv) override;
 
     ~MassSpring() override = default;
 
 private:
 
-    void updateObjectState() override;
+    void updateObjectState(const VectorXR& positions) override;
 
     PhysicManager &manager;
     Object &object;
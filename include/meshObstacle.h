@@ -0,0 +1,41 @@
+#ifndef WGPU_PS_MESHOBSTACLE_H
+#define WGPU_PS_MESHOBSTACLE_H
+
+#include <obstacle.h>
+#include <bvh.h>
+#include <object.h>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Static triangle mesh the cloth collides with, such as a loaded OBJ. The nodes near the surface are
+//found through a BVH over its triangles. The triangles are expected to be wound counter clockwise
+//seen from outside, so a node on the back side of its closest triangle is inside the mesh.
+class MeshObstacle : public Obstacle{
+public:
+    //Coulomb friction coefficient of the contacts
+    float friction = 0.3f;
+    //Also catch the nodes whose motion over the step crossed the surface, by casting it as a ray
+    bool continuous = true;
+
+    explicit MeshObstacle(const Object& object);
+
+    void initialize(ThreadPool& pool) override;
+
+    void resolveContacts(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                         float thickness, float h, ThreadPool& pool) const override;
+
+    //Closest hit of a ray with the obstacle
+    bool raycast(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float maxT,
+                 TriangleBVH::RayHit& hit) const;
+
+    const TriangleBVH& getBVH() const { return bvh; }
+
+private:
+    VectorXR positions;
+    Vectori triangles;
+    //Unit normal of every triangle, 3 floats each
+    std::vector<float> normals;
+    TriangleBVH bvh;
+};
+
+#endif //WGPU_PS_MESHOBSTACLE_H
@@ -0,0 +1,113 @@
+#ifndef WGPU_PS_MULTIGRID_H
+#define WGPU_PS_MULTIGRID_H
+
+#include <threadPool.h>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+using TripletR = Eigen::Triplet<float>;
+
+//Precomputed sparse product out = left * right for operands whose patterns never change. The
+//pattern of out and, for every value of out, the pairs of operand values it sums are built once,
+//so recomputing the product does not allocate and runs in parallel over the columns of out.
+class SparseProductPlan {
+public:
+    void build(const SparseMatrixR &left, const SparseMatrixR &right, SparseMatrixR &out);
+
+    void apply(const SparseMatrixR &left, const SparseMatrixR &right, SparseMatrixR &out, ThreadPool &pool) const;
+
+private:
+    //Terms of column j of out are [columnTerms[j], columnTerms[j + 1])
+    std::vector<int> columnTerms;
+    std::vector<int> outIndex;
+    std::vector<int> leftIndex;
+    std::vector<int> rightIndex;
+};
+
+//Geometric multigrid V-cycle used as a CG preconditioner for the implicit system. The hierarchy is
+//built once from the node positions: each level clusters the nodes of the previous one on a
+//regular grid with twice the cell size, and interpolates them from the nearby cluster centers.
+//The coarse operators are Galerkin products P^T A P, refreshed at every compute(). The smoother
+//is a damped Jacobi sweep, parallel over the DoFs. The coarsest level is solved with a dense LDLT
+//whose storage is sized in setup(), so compute() and the V-cycle never allocate.
+class MultigridPreconditioner {
+public:
+    typedef float Scalar;
+    typedef int StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    int preSmoothing = 2;
+    int postSmoothing = 2;
+    float jacobiWeight = 0.6f;
+    //The coarsening stops once a level has at most this many nodes
+    int coarsestNodes = 64;
+    int maxLevels = 8;
+    //Jacobi sweeps that replace the direct solve when the coarsening stops above coarsestNodes
+    int coarsestSweeps = 8;
+
+    Eigen::Index rows() const { return levels.empty() ? 0 : levels[0].b.size(); }
+
+    Eigen::Index cols() const { return rows(); }
+
+    int numLevels() const { return (int) levels.size(); }
+
+    //Build the hierarchy for a system with the pattern of A, whose DoFs are the coordinates of
+    //nodes at positions. Coupled nodes (off diagonal blocks of A) are taken as the mesh edges.
+    void setup(const SparseMatrixR &A, const Eigen::Ref<const VectorXR> &positions, ThreadPool &pool);
+
+    //Refresh the coarse operators, smoothers and coarsest factorization for the values of A
+    MultigridPreconditioner &compute(const SparseMatrixR &A);
+
+    Eigen::ComputationInfo info() { return Eigen::Success; }
+
+    template<typename Rhs, typename Dest>
+    void _solve_impl(const Rhs &b, Dest &x) const {
+        levels[0].b = b;
+        vCycle(0);
+        x = levels[0].x;
+    }
+
+    template<typename Rhs>
+    const Eigen::Solve<MultigridPreconditioner, Rhs> solve(const Eigen::MatrixBase<Rhs> &b) const {
+        return Eigen::Solve<MultigridPreconditioner, Rhs>(*this, b.derived());
+    }
+
+private:
+    struct Level {
+        //System of the level (the fine one is not owned) and prolongation from the next coarser level
+        const SparseMatrixR* A = nullptr;
+        SparseMatrixR coarseA;
+        SparseMatrixR P;
+        SparseMatrixR R;
+        SparseMatrixR AP;
+        SparseProductPlan apPlan;
+        SparseProductPlan galerkinPlan;
+        VectorXR diagonalInv;
+        mutable VectorXR x;
+        mutable VectorXR b;
+        mutable VectorXR r;
+    };
+
+    std::vector<Level> levels;
+    ThreadPool* threadPool = nullptr;
+
+    //Dense copy and factorization of the coarsest level, only when it has at most coarsestNodes nodes
+    bool coarsestDirect = false;
+    Eigen::MatrixXf coarsestMatrix;
+    Eigen::LDLT<Eigen::MatrixXf> coarsestSolver;
+
+    void vCycle(int l) const;
+
+    void smooth(const Level &level, int sweeps) const;
+
+    //out = M^T * x, one column per output entry so it runs in parallel without conflicts
+    void transposeProduct(const SparseMatrixR &M, const VectorXR &x, VectorXR &out) const;
+};
+
+#endif //WGPU_PS_MULTIGRID_H
@@ -0,0 +1,27 @@
+#ifndef WGPU_PS_OBSTACLE_H
+#define WGPU_PS_OBSTACLE_H
+
+#include <threadPool.h>
+#include <Eigen/Dense>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+class Obstacle{
+public:
+    /// <summary>
+    /// Build the acceleration structures of the obstacle. Called once by PhysicManager::initialize().
+    /// </summary>
+    virtual void initialize(ThreadPool& pool) = 0;
+
+    /// <summary>
+    /// Push the nodes closer than thickness to the obstacle (or inside it) out to that distance, and
+    /// remove the velocity towards it, after a step of h seconds that moved them from pos - h * vel.
+    /// Nodes with zero inverse mass are fixed and left untouched.
+    /// </summary>
+    virtual void resolveContacts(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                                 float thickness, float h, ThreadPool& pool) const = 0;
+
+    virtual ~Obstacle() = default;
+};
+
+#endif //WGPU_PS_OBSTACLE_H
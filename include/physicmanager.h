@@ -2,36 +2,279 @@
 #define PHYSIC_MANAGER_H
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+#include <Eigen/SparseCholesky>
+#include <Eigen/OrderingMethods>
 #include <iostream>
 #include <simulable.h>
+#include <obstacle.h>
+#include <sweepAndPrune.h>
 #include <enums.h>
+#include <threadPool.h>
+#include <conjugateGradient.h>
+#include <implicitOperator.h>
+#include <blockSparseMatrix.h>
+#include <preconditioners.h>
+#include <multigrid.h>
+#include <tripleBuffer.h>
+#include <spscQueue.h>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <thread>
 
 using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
 using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
 using Vector3R = Eigen::Matrix<float, 3, 1>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+using TripletR = Eigen::Triplet<float>;
 
+//Positions published by the simulation for the renderer: the states before and after the
+//last fixed frame, and the wall time the current one corresponds to.
+struct RenderState {
+    VectorXR previous;
+    VectorXR current;
+    std::chrono::steady_clock::time_point time;
+};
 
 class PhysicManager{
 
 public:
     bool paused;
+    //Maximum length of a substep. Each frame runs as many substeps as needed to cover frameTime.
     float timeStep;
+    //Simulated time advanced by each fixedUpdate(), in seconds
+    double frameTime;
+    //Maximum number of frames run by a single update() to catch up with real time
+    int maxCatchUpFrames;
+    //Wall time accumulated but not simulated yet, and wall time dropped because we fell behind
+    double lag;
+    double droppedTime;
+    //Blend the previous and current published states by the time elapsed since the last frame
+    bool interpolateRenderState;
     Vector3R gravity;
     std::vector<std::unique_ptr<Simulable>> simObjs;
+    //Static geometry the simulables collide with
+    std::vector<std::unique_ptr<Obstacle>> obstacles;
+    //Pairs of simulables whose bounds overlap, found after each step and handed to their
+    //solveObjectCollisions(). Box i is the i-th simulable in the order of the state.
+    SweepAndPrune broadphase;
     Integration integrationMethod;
+    //Size of the global state, and number of its leading DoFs moved by the global integrator.
+    //The DoFs of self integrated simulables are placed after those.
     int numDoFs;
+    int numSolverDoFs;
+    //Substep length the simulables were last told about
+    float substepSize;
+
+    //Adaptive stepping. The solver DoFs advance with a step length picked after each step from a
+    //step doubling error estimate, instead of fixed substeps. The error is measured without collisions,
+    //which are resolved once per accepted step. Self integrated simulables keep the fixed substeps, as
+    //their solvers are built for a constant step.
+    bool adaptiveTimeStep;
+    float minTimeStep;
+    float maxTimeStep;
+    //Largest position difference (in meters) between one full step and two half steps that is accepted
+    float adaptiveTolerance;
+    //Fraction of the stability bound of the explicit forces the step may reach
+    float cflSafety;
+    //Stability bound computed in initialize(), infinite when every force is integrated implicitly
+    float stableTimeStep;
+    //Length of the last accepted adaptive step, steps taken in the last frame and rejected steps so far
+    float lastTimeStep;
+    int lastFrameSteps;
+    int rejectedSteps;
+
+    //Run the RK4 stage updates (derivative sums and next stage state, fused in one pass) over
+    //parallel chunks of the state, like the force kernels, instead of on the calling thread
+    bool batchExplicitStages;
+
+    //Workers shared by the parallel passes of the simulables
+    ThreadPool threadPool;
+
+    //Global state. Every simulable reads and writes its own segment in place.
+    VectorXR x;
+    VectorXR v;
+
+    //Lumped mass and inverse mass of every solver DoF, gathered once in initialize()
+    VectorXR mass;
+    VectorXR massInv;
+
+    //Implicit solver settings
+    LinearSolver linearSolver;
+    PreconditionerType preconditionerType;
+    float solverTolerance;
+    int solverMaxIterations;
+    //Run the CG products of the assembled implicit solve on a symmetric 3x3 block copy of the system
+    bool blockSystemMatrix;
+    int lastSolverIterations;
+    float lastSolverError;
+    //Preconditioner used by the CG solves (the one picked for AutoPrecond) and its last setup time in milliseconds
+    PreconditionerType activePreconditioner;
+    float lastPreconditionerTime;
+    //Direct solver timings in milliseconds. The pattern is only analyzed in initialize().
+    float analyzeTime;
+    float lastFactorizeTime;
+    float lastSolveTime;
 
     PhysicManager();
 
+    ~PhysicManager();
+
     void initialize();
 
+    void update(double elapsedTime);
+
+    //Run the simulation on its own thread, decoupled from the render loop. The states it
+    //publishes are picked up by syncRenderState().
+    void startThread();
+
+    void stopThread();
+
+    bool isThreaded() const { return simulationThread.joinable(); }
+
+    //Called by the render thread before reading the objects. It writes into them the
+    //published state, interpolated at the current time if interpolateRenderState is set.
+    void syncRenderState();
+
+    //Commands are queued and run by the simulation (update) thread
+    void sendCommand(SimulationCommand command);
+
     void fixedUpdate();
 
-    void stepSymplectic();
+    int getNumSubsteps() const;
+
+    void step(float h);
+
+    void stepExplicit(float h);
+
+    void stepSymplectic(float h);
+
+    void stepVelocityVerlet(float h);
+
+    void stepRK4(float h);
+
+    void stepImplicit(float h);
+
+    void stepImplicitMatrixFree(float h);
+
+    void stepIMEX(float h);
+
+    //Advance the solver DoFs by duration seconds with adaptive steps
+    void stepAdaptive(double duration);
 
     void unPause();
 
+    void setNumThreads(int numThreads);
+
+private:
+    //Force jacobians and system matrix of the implicit integrator. They all share the
+    //sparsity pattern built in initialize(), so the values can be combined directly.
+    SparseMatrixR dFdx;
+    SparseMatrixR dFdv;
+    SparseMatrixR A;
+    BlockSparseMatrix blockA;
+    //The system is symmetric positive definite and its pattern never changes, so the AMD ordering
+    //and symbolic factorization are computed once and each step only factorizes numerically.
+    //Eigen's numeric factorization allocates its temporaries on every step; the solve does not.
+    Eigen::SimplicialLDLT<SparseMatrixR, Eigen::Lower, Eigen::AMDOrdering<int>> directSolver;
+    std::vector<int> fixedDoFs;
+    std::vector<Simulable*> solverSims;
+    std::vector<Simulable*> selfIntegratedSims;
+    //Every simulable in the order of the state, with the start of its DoFs and its bounds (6 floats)
+    std::vector<Simulable*> broadphaseSims;
+    std::vector<int> simStart;
+    std::vector<float> simBounds;
+    ConjugateGradientSolver cg;
+    Eigen::DiagonalPreconditioner<float> preconditioner;
+    BlockJacobiPreconditioner blockJacobi;
+    GaussSeidelPreconditioner gaussSeidel;
+    MultigridPreconditioner multigrid;
+    Eigen::IncompleteCholesky<float, Eigen::Lower, Eigen::AMDOrdering<int>> incompleteCholesky;
+    //Matrix free implicit system
+    ImplicitOperator implicitOperator;
+    MassPreconditioner massPreconditioner;
+
+    //Per-step workspaces, sized in initialize() so that stepping never allocates
+    VectorXR f;
+    VectorXR b;
+    VectorXR tmp;
+    //Permuted right hand side of the direct solve, and the inverse of its factor's diagonal
+    VectorXR directWork;
+    VectorXR directDiagonalInv;
+    //Adaptive stepping: state before the step, positions after a single full step, and next step length
+    VectorXR savedX;
+    VectorXR savedV;
+    VectorXR singleStepX;
+    float nextTimeStep;
+    //Explicit stage buffers: RK4 start state and weighted sums of the stage derivatives, and the
+    //acceleration velocity Verlet carries over to the next step
+    VectorXR stageX0;
+    VectorXR stageV0;
+    VectorXR stageSumX;
+    VectorXR stageSumV;
+    VectorXR verletAccel;
+    bool verletAccelValid;
+
+    //Simulation thread
+    std::thread simulationThread;
+    std::atomic<bool> simulationRunning{false};
+    SpscQueue<SimulationCommand, 64> commands;
+    //States published by the simulation (update) thread for the render thread, and the
+    //render thread's interpolated positions
+    TripleBuffer<RenderState> renderStates;
+    VectorXR renderPositions;
+
+    void simulationLoop();
+
+    void processCommands();
+
+    void publishRenderState();
+
+    void resizeWorkspaces();
+
+    void stepSelfIntegrated(float h);
+
+    //Update the bounds of the simulables and resolve the contacts of the pairs that overlap
+    void solveObjectCollisions(float h);
+
+    //Advance the solver DoFs by h seconds with the selected integration method
+    void stepSolver(float h);
+
+    //Resolve the self-collisions of the solver simulables after a step of h seconds
+    void solveSolverCollisions(float h);
+
+    //Order of accuracy of the selected integration method, which sets how the adaptive step scales with the error
+    int integrationOrder() const;
+
+    //Sum the forces of the solver simulables into f
+    void evaluateForces();
+
+    //Add the derivatives of the current RK4 stage with the given weight and move the state to the next
+    //stage, stepping from the start state along the current derivatives or, on the last stage, the sums
+    void applyRK4Stage(int begin, int count, float weight, float step, bool last);
+
+    //Pattern of the jacobians and system matrix, of all the forces or only of the stiff ones (IMEX)
+    void buildJacobianPattern(bool stiffOnly);
+
+    void applyFixedDoFs(SparseMatrixR &matrix, VectorXR &rhs);
+
+    //Solve A * solution = b with the selected linear solver
+    void solveSystem(Eigen::Ref<VectorXR> solution);
+
+    //Factorize A with the cached symbolic analysis and solve A * solution = b
+    void solveDirect(Eigen::Ref<VectorXR> solution);
+
+    //Set up the given preconditioner and solve A * solution = b with CG
+    void solveIterative(PreconditionerType type, Eigen::Ref<VectorXR> solution);
+
+    template<typename Preconditioner>
+    void runCG(const Preconditioner &precond, Eigen::Ref<VectorXR> solution);
+
+    //Preconditioner used for AutoPrecond, chosen in initialize() from the size of the free system
+    PreconditionerType selectPreconditioner() const;
+
 };
 
 #endif
\ No newline at end of file
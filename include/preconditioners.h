@@ -0,0 +1,92 @@
+#ifndef WGPU_PS_PRECONDITIONERS_H
+#define WGPU_PS_PRECONDITIONERS_H
+
+#include <blockSparseMatrix.h>
+#include <Eigen/Dense>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Preconditioners built from the symmetric 3x3 block copy of the implicit system. They follow
+//Eigen's preconditioner interface (compute() and a solve() expression), so they work both with
+//ConjugateGradientSolver and with Eigen's iterative solvers.
+
+//Inverts the 3x3 diagonal block of every node, so the coupling between the coordinates of a
+//node (the spring directions) is captured, unlike with the scalar diagonal.
+class BlockJacobiPreconditioner {
+public:
+    typedef float Scalar;
+    typedef int StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    Eigen::Index rows() const { return 3 * numBlocks; }
+
+    Eigen::Index cols() const { return 3 * numBlocks; }
+
+    BlockJacobiPreconditioner &compute(const BlockSparseMatrix &m);
+
+    Eigen::ComputationInfo info() { return Eigen::Success; }
+
+    //Inverse of the diagonal block of node i, row major
+    Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> inverseBlock(int i) const {
+        return Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>>(&inverseBlocks[9 * i]);
+    }
+
+    template<typename Rhs, typename Dest>
+    void _solve_impl(const Rhs &b, Dest &x) const {
+        for (int i = 0; i < numBlocks; i++)
+            x.template segment<3>(3 * i).noalias() = inverseBlock(i) * b.template segment<3>(3 * i);
+    }
+
+    template<typename Rhs>
+    const Eigen::Solve<BlockJacobiPreconditioner, Rhs> solve(const Eigen::MatrixBase<Rhs> &b) const {
+        return Eigen::Solve<BlockJacobiPreconditioner, Rhs>(*this, b.derived());
+    }
+
+private:
+    int numBlocks = 0;
+    std::vector<float> inverseBlocks;
+};
+
+//Symmetric block Gauss-Seidel sweep over the node graph: a forward sweep followed by a backward
+//sweep, M = (D + L) D^-1 (D + U). The lower blocks are the transposes of the stored upper ones.
+class GaussSeidelPreconditioner {
+public:
+    typedef float Scalar;
+    typedef int StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    Eigen::Index rows() const { return diagonal.rows(); }
+
+    Eigen::Index cols() const { return diagonal.cols(); }
+
+    GaussSeidelPreconditioner &compute(const BlockSparseMatrix &m);
+
+    Eigen::ComputationInfo info() { return Eigen::Success; }
+
+    template<typename Rhs, typename Dest>
+    void _solve_impl(const Rhs &b, Dest &x) const {
+        sweep(b, x);
+    }
+
+    template<typename Rhs>
+    const Eigen::Solve<GaussSeidelPreconditioner, Rhs> solve(const Eigen::MatrixBase<Rhs> &b) const {
+        return Eigen::Solve<GaussSeidelPreconditioner, Rhs>(*this, b.derived());
+    }
+
+private:
+    void sweep(const Eigen::Ref<const VectorXR> &b, Eigen::Ref<VectorXR> x) const;
+
+    const BlockSparseMatrix* matrix = nullptr;
+    BlockJacobiPreconditioner diagonal;
+    //Right hand side updated by the forward sweep
+    mutable VectorXR remainder;
+};
+
+#endif //WGPU_PS_PRECONDITIONERS_H
@@ -0,0 +1,92 @@
+#ifndef WGPU_PS_PROJECTIVEDYNAMICSCLOTH_H
+#define WGPU_PS_PROJECTIVEDYNAMICSCLOTH_H
+
+#include <spring.h>
+#include <simulable.h>
+#include <physicmanager.h>
+#include <object.h>
+#include <fixedPointAccelerator.h>
+#include <Eigen/SparseCholesky>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
+using Vector3R = Eigen::Matrix<float, 3, 1>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+
+//Cloth simulated with Projective Dynamics. Every stretch and bend edge is a constraint that
+//projects its nodes to the rest length. The global system M/h^2 + sum(w A^T A) is the same for
+//the three coordinates and does not change with the state, so it is factored only when the
+//substep changes and each iteration is a local projection plus two triangular solves.
+class ProjectiveDynamicsCloth : public Simulable{
+public:
+
+    Eigen::Map<VectorXR> pos{nullptr, 0};
+    Eigen::Map<VectorXR> vel{nullptr, 0};
+    VectorXR nodeMass;
+    VectorXR nodeMassInv;
+    int numNodes{};
+
+    //Constraint topology, rest lengths and weights (the spring stiffness)
+    SpringSet constraints;
+
+    float mass{};
+    float stiffnessStretch{};
+    float stiffnessBend{};
+    float dampingAlpha{};
+    int iterations{10};
+    //Opt-in acceleration of the local/global iterations
+    FixedPointAccelerator accelerator;
+    int index{};
+
+    ProjectiveDynamicsCloth(float mass, float stiffnessStretch, float stiffnessBend, float dampingAlpha,
+                            int iterations, PhysicManager &manager, Object &object);
+
+    void initialize(int i) override;
+
+    int getNumDoFs() override;
+
+    bool isSelfIntegrated() override { return true; }
+
+    void step(float h) override;
+
+    void setTimeStep(float h) override;
+
+    void bindState(VectorXR& x, VectorXR& v) override;
+
+    void updateState() override;
+
+    void getMass(VectorXR& m) override;
+
+    void getMassInverse(VectorXR& massInv) override;
+
+    ~ProjectiveDynamicsCloth() override = default;
+
+private:
+
+    void updateObjectState(const VectorXR& positions) override;
+
+    //Assemble the global matrix for a substep of length h. Fixed nodes get an identity row.
+    void buildSystem(float h);
+
+    PhysicManager &manager;
+    Object &object;
+
+    SparseMatrixR system;
+    Eigen::SimplicialLDLT<SparseMatrixR> solver;
+    //Inverse of the D factor (vectorD() returns a copy)
+    VectorXR diagonalInv;
+    //Substep length the factorization was computed for
+    float factoredStep{};
+
+    //Node data with one row per node and one column per coordinate, the layout of the solves
+    Eigen::Matrix<float, Eigen::Dynamic, 3> inertia;
+    Eigen::Matrix<float, Eigen::Dynamic, 3> rhs;
+    Eigen::Matrix<float, Eigen::Dynamic, 3> permuted;
+    Eigen::Matrix<float, Eigen::Dynamic, 3> solution;
+    //Constant right hand side term of the nodes constrained to a fixed node
+    Eigen::Matrix<float, Eigen::Dynamic, 3> fixedCoupling;
+    VectorXR prevPos;
+
+};
+
+#endif //WGPU_PS_PROJECTIVEDYNAMICSCLOTH_H
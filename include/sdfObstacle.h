@@ -0,0 +1,70 @@
+#ifndef WGPU_PS_SDFOBSTACLE_H
+#define WGPU_PS_SDFOBSTACLE_H
+
+#include <obstacle.h>
+#include <object.h>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Static triangle mesh baked into a signed distance field on a regular grid, negative inside. The
+//distances are exact within a narrow band around the surface and extended to the rest of the grid by
+//fast sweeping. A node is then resolved with one trilinear lookup, so the cost of a contact does not
+//depend on the number of triangles. The triangles are expected to be wound counter clockwise seen from
+//outside, as for MeshObstacle.
+class SDFObstacle : public Obstacle{
+public:
+    //Grid cells along the longest side of the mesh bounds
+    int resolution = 64;
+    //Cells around the surface whose distance is computed from the triangles
+    int narrowBand = 3;
+    //Coulomb friction coefficient of the contacts
+    float friction = 0.3f;
+    //File the grid is loaded from when it was baked from the same mesh and settings, and saved to
+    //otherwise. Empty to always bake.
+    std::filesystem::path cachePath;
+
+    explicit SDFObstacle(const Object& object);
+
+    void initialize(ThreadPool& pool) override;
+
+    void resolveContacts(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                         float thickness, float h, ThreadPool& pool) const override;
+
+    //Signed distance and its gradient at p. Returns false outside the grid.
+    bool sample(const Eigen::Vector3f& p, float& distance, Eigen::Vector3f& gradient) const;
+
+    bool loadedFromCache() const { return cached; }
+
+private:
+    VectorXR positions;
+    Vectori triangles;
+
+    //Grid points (i, j, k) at origin + cellSize * (i, j, k), stored x first
+    Eigen::Vector3f origin;
+    float cellSize = 0.0f;
+    int dims[3] = {0, 0, 0};
+    std::vector<float> phi;
+    bool cached = false;
+
+    //Points of the band, which the sweeps leave as baked, and per task flags of the sweeps set when a
+    //value changed. Only used while baking.
+    std::vector<char> frozen;
+    std::vector<char> taskChanged;
+
+    int index(int i, int j, int k) const { return (k * dims[1] + j) * dims[0] + i; }
+
+    void bakeBand(ThreadPool& pool);
+
+    bool sweep(int sx, int sy, int sz, ThreadPool& pool);
+
+    std::uint64_t hash() const;
+
+    bool loadCache(std::uint64_t key);
+
+    void saveCache(std::uint64_t key) const;
+};
+
+#endif //WGPU_PS_SDFOBSTACLE_H
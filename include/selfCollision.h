@@ -0,0 +1,115 @@
+#ifndef WGPU_PS_SELFCOLLISION_H
+#define WGPU_PS_SELFCOLLISION_H
+
+#include <object.h>
+#include <threadPool.h>
+#include <Eigen/Dense>
+#include <vector>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+
+//Proximity based cloth self-collision. Vertex-triangle and edge-edge pairs closer than a thickness
+//are pushed apart with velocity impulses after each step. The candidate pairs come from a uniform
+//spatial hash of the vertices and edge midpoints, rebuilt every step with a counting sort, so the
+//cost grows with the number of primitives instead of the number of pairs.
+class SelfCollision{
+public:
+    //Contact distance, as a fraction of the mean rest edge length (which is also the hash cell size)
+    float thicknessScale = 0.2f;
+    //Fraction of the thickness violation removed per step
+    float repulsion = 1.0f;
+    //Response passes over the candidates found at the start of a step
+    int iterations = 2;
+    //Room of the fixed buffers, set in initialize(): candidate pairs per triangle or edge, and hash
+    //cells per edge. Both are averages over the primitives of a task.
+    int candidatesPerPrimitive = 12;
+    int cellsPerEdge = 8;
+
+    //Candidate pairs found by the last broadphase, and pairs in contact in the last response pass
+    int lastCandidates = 0;
+    int lastContacts = 0;
+    //Candidate pairs and edge hash entries of the last step that did not fit in the buffers and were dropped
+    int lastDroppedCandidates = 0;
+    int lastDroppedCells = 0;
+
+    //Build the edges and size the hash for a mesh at its rest positions
+    void initialize(const VectorXR& positions, const Vectori& triangles);
+
+    //Resolve the contacts at pos after a step of h seconds, correcting velocities and positions in
+    //place. nodeMassInv holds the inverse mass of each node, zero for fixed nodes.
+    void solve(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv, float h,
+               ThreadPool& pool);
+
+    float getThickness() const { return thickness; }
+
+private:
+    int numNodes = 0;
+    int numTriangles = 0;
+    int numEdges = 0;
+    //Node indices, 3 per triangle and 2 per edge
+    std::vector<int> triangles;
+    std::vector<int> edges;
+    float thickness = 0.0f;
+    float cellSize = 1.0f;
+    int tableMask = 0;
+
+    //Spatial hashes. Entry i of a table sits in cell (cells[3i], cells[3i + 1], cells[3i + 2]) and the
+    //entries of bucket k are sorted[start[k]] to sorted[start[k + 1] - 1], whose items and cells are
+    //copied in bucket order so a bucket is scanned contiguously. A vertex has one entry,
+    //in the cell of its position. An edge has one entry per cell overlapped by its bounds grown by
+    //half the thickness, [edgeEntryStart[e], edgeEntryStart[e + 1]), as long as they fit in the table.
+    std::vector<int> vertexCells;
+    std::vector<int> vertexKeys;
+    std::vector<int> vertexStart;
+    std::vector<int> vertexSorted;
+    std::vector<int> vertexSortedCells;
+    std::vector<float> edgeBounds;
+    std::vector<int> edgeEntryStart;
+    std::vector<int> edgeEntries;
+    std::vector<int> edgeCells;
+    std::vector<int> edgeKeys;
+    std::vector<int> edgeStart;
+    std::vector<int> edgeSorted;
+    std::vector<int> edgeSortedItems;
+    std::vector<int> edgeSortedCells;
+
+    //Candidate pairs found by each task of the broadphase. The buffers have a fixed room, and the
+    //pairs a task finds past it are dropped.
+    std::vector<std::vector<int>> triangleChunkPairs;
+    std::vector<std::vector<int>> edgeChunkPairs;
+    std::vector<int> triangleChunkCounts;
+    std::vector<int> edgeChunkCounts;
+
+    //Every candidate acts on 4 nodes: a vertex and a triangle, or two edges. The vertex-triangle
+    //candidates come first. Its relative velocity is sum(weight * v) along the normal, and the
+    //impulse found by the narrowphase (zero if not in contact) changes the velocity of each node
+    //by weight * massInv * impulse * normal.
+    int numVertexTriangle = 0;
+    int numCandidates = 0;
+    std::vector<int> candidateNodes;
+    std::vector<float> candidateWeights;
+    std::vector<float> candidateNormals;
+    std::vector<float> candidateImpulses;
+    std::vector<int> chunkContacts;
+
+    //Candidate slots touching each node, [nodeStart[i], nodeStart[i + 1]), so the impulses can be
+    //gathered in parallel over the nodes
+    std::vector<int> nodeStart;
+    std::vector<int> nodeEntries;
+
+    void buildHash(const float* pos, ThreadPool& pool);
+
+    void findCandidates(const float* pos, ThreadPool& pool);
+
+    void gatherCandidates();
+
+    void computeImpulses(const float* pos, const float* vel, const float* massInv, float h, ThreadPool& pool);
+
+    void vertexTriangleBatch(int begin, int count, const float* pos, const float* vel, const float* massInv, float h);
+
+    void edgeEdgeBatch(int begin, int count, const float* pos, const float* vel, const float* massInv, float h);
+
+    void applyImpulses(float* pos, float* vel, const float* massInv, float h, ThreadPool& pool);
+};
+
+#endif //WGPU_PS_SELFCOLLISION_H
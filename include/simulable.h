@@ -1,11 +1,14 @@
 #ifndef SIMULABLE_H
 #define SIMULABLE_H
 
-#include <physicmanager.h>
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <vector>
 
 using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
 using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+using TripletR = Eigen::Triplet<float>;
 
 class PhysicManager;
 
@@ -22,49 +25,106 @@ public:
     virtual int getNumDoFs() = 0;
 
     /// <summary>
-    /// Write position values into the position vector.
+    /// Returns true if the simulable advances its own state in step() (e.g. a constraint
+    /// based solver) instead of being moved by the global force based integrator.
     /// </summary>
-    virtual void getPosition(VectorXR& position) = 0;
+    virtual bool isSelfIntegrated() { return false; }
 
     /// <summary>
-    /// Set position values from the position vector.
+    /// Advance the state of a self integrated simulable by h seconds.
     /// </summary>
-    virtual void setPosition(VectorXR& position) = 0;
+    virtual void step(float h) { static_cast<void>(h); }
 
     /// <summary>
-    /// Write velocity values into the velocity vector.
+    /// Called before stepping whenever the substep length changes, outside of the allocation
+    /// free part of the step, so a simulable can rebuild data that depends on it.
     /// </summary>
-    virtual void getVelocity(VectorXR& velocity) = 0;
+    virtual void setTimeStep(float h) { static_cast<void>(h); }
 
     /// <summary>
-    /// Set velocity values from the velocity vector.
+    /// Resolve the contacts of the state reached by a step of h seconds, correcting the positions
+    /// and velocities in place. Called after every step.
     /// </summary>
-    virtual void setVelocity(VectorXR& velocity) = 0;
+    virtual void solveCollisions(float h) { static_cast<void>(h); }
 
     /// <summary>
-    /// Write force values into the force vector.
+    /// Resolve the contacts with another simulable whose bounds overlap this one's, correcting only
+    /// the positions and velocities of this simulable. Called after every step, once in each direction
+    /// for every overlapping pair found by the broadphase of the manager.
     /// </summary>
-    virtual void getFore(VectorXR& force) = 0;
+    virtual void solveObjectCollisions(Simulable& other, float h) { static_cast<void>(other); static_cast<void>(h); }
 
     /// <summary>
-    /// Write force jacobian values into the matrix.
+    /// Upper bound of the squared natural frequency (stiffness over mass) of the forces, which limits
+    /// the stable explicit time step. With excludeStiff the stiff forces (integrated implicitly by IMEX)
+    /// are left out. Zero if the simulable does not bound the step.
     /// </summary>
-    virtual void getForceJacobian(MatrixXR& dFdx, MatrixXR& dFdv) = 0;
+    virtual float getMaxStiffnessMassRatio(bool excludeStiff) { static_cast<void>(excludeStiff); return 0.0f; }
 
     /// <summary>
-    /// Write mass values into the mass matrix.
+    /// Bind the simulable state to its segment of the global position and velocity vectors.
+    /// The initial state is written there, and from then on it is read and written in place.
     /// </summary>
-    virtual void getMass(MatrixXR& mass) = 0;
+    virtual void bindState(VectorXR& x, VectorXR& v) = 0;
 
     /// <summary>
-    /// Write inverse of mass values into the inverse mass matrix.
+    /// Update the state derived from the positions after the integrator has changed them.
     /// </summary>
-    virtual void getMassInverse(MatrixXR& massInv) = 0;
+    virtual void updateState() = 0;
 
     /// <summary>
-    /// Update the object positions so that the render pipeline can read them
+    /// Write force values into the force vector. The defaults of this and the jacobian methods
+    /// below contribute nothing, which suits the self integrated simulables.
     /// </summary>
-    virtual void updateObjectState() = 0;
+    virtual void getFore(VectorXR& force) { static_cast<void>(force); }
+
+    /// <summary>
+    /// Write the (zero valued) entries the simulable touches in the force jacobians.
+    /// It is called once, so the sparsity pattern is built from the topology only.
+    /// </summary>
+    virtual void getForceJacobianPattern(std::vector<TripletR>& pattern) { static_cast<void>(pattern); }
+
+    /// <summary>
+    /// Add the force jacobian values into the matrices. They already hold the pattern
+    /// returned by getForceJacobianPattern, so no new entries may be created.
+    /// </summary>
+    virtual void getForceJacobian(SparseMatrixR& dFdx, SparseMatrixR& dFdv) { static_cast<void>(dFdx); static_cast<void>(dFdv); }
+
+    /// <summary>
+    /// Add (h * dFdx + dFdv) * dv into out without assembling the jacobians, which is the force
+    /// change caused by a velocity change dv over a step h. With h = 0 it is the damping term only.
+    /// </summary>
+    virtual void applyForceJacobian(const Eigen::Ref<const VectorXR>& dv, VectorXR& out, float h) {
+        static_cast<void>(dv);
+        static_cast<void>(out);
+        static_cast<void>(h);
+    }
+
+    /// <summary>
+    /// Pattern of the jacobian of the stiff forces, the only ones the IMEX integrator treats implicitly.
+    /// </summary>
+    virtual void getStiffForceJacobianPattern(std::vector<TripletR>& pattern) { static_cast<void>(pattern); }
+
+    /// <summary>
+    /// Add the position jacobian of the stiff forces into the pre-patterned matrix.
+    /// </summary>
+    virtual void getStiffForceJacobian(SparseMatrixR& dFdx) { static_cast<void>(dFdx); }
+
+    /// <summary>
+    /// Write the lumped (diagonal) mass of every DoF into the mass vector.
+    /// </summary>
+    virtual void getMass(VectorXR& mass) = 0;
+
+    /// <summary>
+    /// Write the inverse of the lumped mass of every DoF into the inverse mass vector.
+    /// </summary>
+    virtual void getMassInverse(VectorXR& massInv) = 0;
+
+    /// <summary>
+    /// Update the object positions from a (published) copy of the global position vector
+    /// so that the render pipeline can read them
+    /// </summary>
+    virtual void updateObjectState(const VectorXR& positions) = 0;
 
     virtual ~Simulable() = default;
 };
@@ -2,36 +2,72 @@
 #define WGPU_PS_SPRING_H
 
 #include <enums.h>
+#include <object.h>
 #include <Eigen/Dense>
-#include <node.h>
+#include <Eigen/Sparse>
+#include <vector>
 
-class Spring{
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using Vector3R = Eigen::Matrix<float, 3, 1>;
+using SparseMatrixR = Eigen::SparseMatrix<float>;
+using TripletR = Eigen::Triplet<float>;
+
+//Springs per task of the parallel passes of the cloth models, a multiple of every SIMD packet size
+constexpr int SpringGrain = 256;
+
+//All the springs of a simulable stored as flat arrays (one entry per spring), so the
+//force pass can evaluate several springs at once with SIMD packets.
+class SpringSet{
 public:
-    float stiffness;
-    float damping;
+    //Offset of the first DoF of each node inside the simulable state
+    std::vector<int> a;
+    std::vector<int> b;
+
+    std::vector<float> length0;
+    std::vector<float> stiffness;
+    std::vector<float> damping;
+    std::vector<SpringType> springType;
+
+    //Springs are sorted by color: no two springs of the same color share a node, so each
+    //color range [colorOffsets[c], colorOffsets[c + 1]) can be evaluated in parallel.
+    std::vector<int> colorOffsets;
+
+    int size() const { return (int) a.size(); }
 
-    Node &nodeA;
-    Node &nodeB;
+    int numColors() const { return (int) colorOffsets.size() - 1; }
 
-    SpringType springType;
+    void clear();
 
-    float length0;
-    float length;
-    VectorXR direction;
+    void add(int nodeA, int nodeB, SpringType type, const Eigen::Ref<const VectorXR>& pos);
 
-    Spring(Node &nodeA, Node &nodeB, SpringType springType, PhysicManager &manager);
+    //Add a stretch spring per mesh edge and a bend spring per pair of triangles sharing an edge
+    void addMeshEdges(const VectorXR& positions, const Vectori& triangles);
 
-    void initialize(float stiff, float damp);
+    void setParameters(SpringType type, float stiff, float damp);
 
-    void updateState();
+    void sortByColor(int numNodes);
 
-    void getForces(VectorXR& force);
+    void getForces(int begin, int end, const float* pos, const float* vel, float* force) const;
 
-    void getForceJacobians(MatrixXR& dFdx, MatrixXR& dFdv);
+    void getForceJacobianPattern(int offset, std::vector<TripletR>& pattern) const;
+
+    void getForceJacobians(int offset, const float* pos, SparseMatrixR& dFdx, SparseMatrixR& dFdv) const;
+
+    //Pattern and position jacobian of the springs of one type
+    void getForceJacobianPattern(int offset, SpringType type, std::vector<TripletR>& pattern) const;
+
+    void getStiffnessJacobian(int offset, SpringType type, const float* pos, SparseMatrixR& dFdx) const;
+
+    //Matrix free product out += (h * dFdx + dFdv) * dv for the springs [begin, end), with the same
+    //3x3 blocks getForceJacobians() assembles
+    void applyForceJacobians(int begin, int end, const float* pos, const float* dv, float h, float* out) const;
 
 private:
-    PhysicManager &manager;
 
+    //dF_a/dx_a block of spring s
+    Eigen::Matrix3f stiffnessBlock(int s, const float* pos) const;
+
+    static void addBlock(SparseMatrixR& m, int row, int col, const Eigen::Matrix3f& block);
 };
 
 #endif //WGPU_PS_SPRING_H
@@ -0,0 +1,40 @@
+#ifndef WGPU_PS_SPSCQUEUE_H
+#define WGPU_PS_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+//Fixed capacity lock-free queue for a single producer thread and a single consumer thread.
+template<typename T, std::size_t Capacity>
+class SpscQueue {
+public:
+
+    //Producer side. Returns false if the queue is full.
+    bool push(const T &item) {
+        std::size_t tail = tailIndex.load(std::memory_order_relaxed);
+        std::size_t next = (tail + 1) % (Capacity + 1);
+        if (next == headIndex.load(std::memory_order_acquire))
+            return false;
+        items[tail] = item;
+        tailIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    //Consumer side. Returns false if the queue is empty.
+    bool pop(T &item) {
+        std::size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+        item = items[head];
+        headIndex.store((head + 1) % (Capacity + 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    //One slot is always left empty to tell a full queue from an empty one
+    T items[Capacity + 1];
+    std::atomic<std::size_t> headIndex{0};
+    std::atomic<std::size_t> tailIndex{0};
+};
+
+#endif //WGPU_PS_SPSCQUEUE_H
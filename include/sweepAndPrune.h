@@ -0,0 +1,87 @@
+#ifndef WGPU_PS_SWEEPANDPRUNE_H
+#define WGPU_PS_SWEEPANDPRUNE_H
+
+#include <cstdint>
+#include <vector>
+
+//Object level broadphase over a fixed set of axis aligned boxes. The box endpoints are kept sorted
+//along the swept axes between updates, so with boxes that move little per step an insertion sort
+//restores the order in close to linear time. Every swap of a start past an end (or the reverse) of two
+//boxes starts (or stops) their overlap on that axis, which keeps the pairs overlapping on all the swept
+//axes up to date without testing the others.
+class SweepAndPrune{
+public:
+    //Swept axes: 3 sorts the endpoints along x, y and z. 1 only sorts them along the axis the boxes are
+    //most spread over, and tests the other two for the pairs overlapping on it, which is cheaper when
+    //the boxes are separated along that axis.
+    int axes = 3;
+    //With a single swept axis, the axis is picked again when the pairs overlapping on it grow past this
+    //factor of their number at the last check, or an update swaps more endpoints than there are. The
+    //endpoints are sorted from scratch if the pick changes.
+    float axisCheckGrowth = 2.0f;
+    //Growth of every box on each side, so the pairs cover contacts that start within this distance
+    float margin = 0.02f;
+
+    //Endpoint swaps made by the last update, which stay low while the boxes move coherently, and sorts
+    //from scratch so far
+    int lastSwaps = 0;
+    int fullSorts = 0;
+
+    //Size the tables for numBoxes boxes. The first update sorts the endpoints from scratch.
+    void initialize(int numBoxes);
+
+    //Move the boxes to bounds, 6 floats (min x, y, z, max x, y, z) per box, and update the pairs
+    void update(const std::vector<float>& bounds);
+
+    //Pairs of overlapping boxes, 2 indices each, the lower first
+    const std::vector<int>& getPairs() const { return pairs; }
+
+    int numPairs() const { return (int) pairs.size() / 2; }
+
+private:
+    //Endpoint id is 2 * box for the start of the box and 2 * box + 1 for its end
+    struct Endpoint {
+        float value;
+        int id;
+    };
+
+    int numBoxes = 0;
+    //Axes the endpoints were last sorted along, none before the first update
+    int numSwept = 0;
+    int sweptAxes[3] = {0, 1, 2};
+    //Pairs overlapping on the single swept axis at the last pick of the axis
+    int checkedPairs = 0;
+    std::vector<float> boxes;
+    std::vector<Endpoint> endpoints[3];
+
+    //Number of swept axes each pair overlaps on, for box pairs (a, b) with a < b at a * numBoxes + b,
+    //and the slot in trackedPairs of the pairs that overlap on all of them (-1 for the others)
+    std::vector<std::uint8_t> overlaps;
+    std::vector<int> pairSlot;
+    std::vector<int> trackedPairs;
+    std::vector<int> pairs;
+
+    //Boxes open during the sweep that counts the overlaps of a full sort
+    std::vector<int> active;
+
+    static bool before(const Endpoint& a, const Endpoint& b) {
+        //At equal values starts go first, so touching boxes overlap
+        return a.value < b.value || (a.value == b.value && !(a.id & 1) && (b.id & 1));
+    }
+
+    void addOverlap(int a, int b);
+
+    void removeOverlap(int a, int b);
+
+    void sortFromScratch(int numAxes);
+
+    //Axis the box centers are most spread over
+    int spreadAxis() const;
+
+    //Whether the single swept axis should be picked again after an update
+    bool axisCheckDue() const;
+
+    void insertionSort(std::vector<Endpoint>& list);
+};
+
+#endif //WGPU_PS_SWEEPANDPRUNE_H
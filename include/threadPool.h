@@ -0,0 +1,68 @@
+#ifndef WGPU_PS_THREADPOOL_H
+#define WGPU_PS_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads that run the tasks of a parallelFor. The calling thread
+//also runs tasks, so a pool of size 1 has no workers and runs everything inline.
+//A dispatch does not allocate: the callable is passed by pointer, not copied into a std::function.
+//Tasks run inside the physics step, so they must not allocate either (checked in debug builds).
+class ThreadPool{
+public:
+
+    explicit ThreadPool(int numThreads = 1);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void resize(int numThreads);
+
+    int size() const { return (int) workers.size() + 1; }
+
+    //Call fn(task) for every task in [0, numTasks) and wait until all of them have finished.
+    //Callers split their work into chunks of a fixed size, never into one chunk per thread, and
+    //each task only writes its own outputs. The order in which tasks run then does not matter, so
+    //the results are bit-identical whatever the number of threads.
+    template<typename F>
+    void parallelFor(int numTasks, const F& fn) {
+        run(numTasks, [](const void* f, int task) { (*static_cast<const F*>(f))(task); }, &fn);
+    }
+
+private:
+
+    using TaskFunction = void (*)(const void*, int);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+
+    //Current job
+    TaskFunction function = nullptr;
+    const void* context = nullptr;
+    int numTasks = 0;
+    std::atomic<int> nextTask{0};
+    int busyWorkers = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    void run(int tasks, TaskFunction f, const void* ctx);
+
+    void runTasks();
+
+    void workerLoop(unsigned long long seenGeneration);
+
+    void stop();
+};
+
+//Nodes per task of the passes over the nodes of a cloth, shared by the models and their collisions
+constexpr int NodeGrain = 1024;
+
+#endif //WGPU_PS_THREADPOOL_H
@@ -0,0 +1,51 @@
+#ifndef WGPU_PS_TRIPLEBUFFER_H
+#define WGPU_PS_TRIPLEBUFFER_H
+
+#include <atomic>
+
+//Lock-free triple buffer to hand values from one writer thread to one reader thread.
+//The writer fills back() and publishes it; the reader picks up the latest published value
+//with update() and reads it from front(). Neither side ever waits for the other, and a
+//value being read is never overwritten.
+template<typename T>
+class TripleBuffer {
+public:
+
+    //Set every slot to value. Not thread safe: call it before the threads start.
+    void reset(const T &value) {
+        for (T &buffer: buffers)
+            buffer = value;
+        backIndex = 0;
+        middle.store(1);
+        frontIndex = 2;
+    }
+
+    //Writer side
+    T &back() { return buffers[backIndex]; }
+
+    void publish() {
+        backIndex = middle.exchange(backIndex | DirtyBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    //Reader side. Returns true if a new value was published since the last call.
+    bool update() {
+        if (!(middle.load(std::memory_order_acquire) & DirtyBit))
+            return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    const T &front() const { return buffers[frontIndex]; }
+
+private:
+    static constexpr int DirtyBit = 4;
+    static constexpr int IndexMask = 3;
+
+    T buffers[3];
+    int backIndex = 0;
+    //Index of the slot in between, plus DirtyBit if the writer published it and the reader did not take it yet
+    std::atomic<int> middle{1};
+    int frontIndex = 2;
+};
+
+#endif //WGPU_PS_TRIPLEBUFFER_H
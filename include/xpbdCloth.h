@@ -0,0 +1,86 @@
+#ifndef WGPU_PS_XPBDCLOTH_H
+#define WGPU_PS_XPBDCLOTH_H
+
+#include <spring.h>
+#include <simulable.h>
+#include <physicmanager.h>
+#include <object.h>
+#include <fixedPointAccelerator.h>
+
+using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
+using Vector3R = Eigen::Matrix<float, 3, 1>;
+
+//Cloth simulated with extended position based dynamics (XPBD). The stretch and bend edges
+//of the mesh are distance constraints whose compliance is the inverse of the spring stiffness.
+//The cloth advances its own state, with a fixed number of constraint passes per step.
+class XPBDCloth : public Simulable{
+public:
+
+    Eigen::Map<VectorXR> pos{nullptr, 0};
+    Eigen::Map<VectorXR> vel{nullptr, 0};
+    VectorXR nodeMass;
+    VectorXR nodeMassInv;
+    int numNodes{};
+
+    //Constraint topology, rest lengths and stiffness, shared with the mass spring model
+    SpringSet constraints;
+
+    float mass{};
+    float stiffnessStretch{};
+    float stiffnessBend{};
+    float dampingAlpha{};
+    int iterations{10};
+    ConstraintSolver solver{ConstraintSolver::GaussSeidel};
+    //Over-relaxation of the averaged Jacobi corrections
+    float jacobiRelaxation{1.5f};
+    //Opt-in acceleration of the constraint iterations
+    FixedPointAccelerator accelerator;
+    int index{};
+
+    XPBDCloth(float mass, float stiffnessStretch, float stiffnessBend, float dampingAlpha, int iterations,
+              ConstraintSolver solver, PhysicManager &manager, Object &object);
+
+    void initialize(int i) override;
+
+    int getNumDoFs() override;
+
+    bool isSelfIntegrated() override { return true; }
+
+    void step(float h) override;
+
+    void bindState(VectorXR& x, VectorXR& v) override;
+
+    void updateState() override;
+
+    void getMass(VectorXR& m) override;
+
+    void getMassInverse(VectorXR& massInv) override;
+
+    ~XPBDCloth() override = default;
+
+private:
+
+    void updateObjectState(const VectorXR& positions) override;
+
+    //Project the constraints [begin, end) of one color and write the position corrections
+    //into target, which is the positions themselves (Gauss-Seidel) or an accumulator (Jacobi).
+    void projectConstraints(int begin, int end, float complianceScale, float* target);
+
+    void projectColors(float complianceScale, float* target);
+
+    PhysicManager &manager;
+    Object &object;
+
+    //Per constraint compliance and accumulated lagrange multiplier
+    VectorXR compliance;
+    VectorXR lambda;
+    //Start of step positions, used to recover the velocities
+    VectorXR prevPos;
+    //Jacobi mode: summed corrections and number of constraints of each node
+    VectorXR correction;
+    VectorXR nodeDegreeInv;
+
+};
+
+#endif //WGPU_PS_XPBDCLOTH_H
@@ -47,6 +47,11 @@ int main() {
             std::unique_ptr<Simulable>(new MassSpring(0.5f, 5.f, 2.5f, 0.001f, 0.001f, physicManager, objectData[0])));
     physicManager.initialize();
 
+    // Run the physics on its own thread so that presenting frames does not stall it
+    constexpr bool physicsThread = true;
+    if (physicsThread)
+        physicManager.startThread();
+
     app.onInit(false);
 
     MyUniforms uniforms{};
@@ -61,37 +66,28 @@ int main() {
     app.m_mvpUniforms.modelMatrix = glm::mat4(1.0f);
     app.m_mvpUniforms.model2Matrix = glm::mat4(1.0f);
 
-    constexpr std::chrono::milliseconds fixedTimeStep(33);
-
     // Initialize variables for tracking time
-    auto currentTime = std::chrono::high_resolution_clock::now();
+    auto currentTime = std::chrono::steady_clock::now();
     auto previousTime = currentTime;
-    std::chrono::milliseconds lag(0);
 
     while (app.isRunning()) {
 
-        currentTime = std::chrono::high_resolution_clock::now();
-        std::chrono::milliseconds elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                currentTime - previousTime);
+        currentTime = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsedTime = currentTime - previousTime;
         previousTime = currentTime;
 
-        // Accumulate lag
-        lag += elapsedTime;
-
         //////    FIXED UPDATE    //////
-        while (lag >= fixedTimeStep) {
-            // Perform fixed update tasks here
-            physicManager.fixedUpdate();
+        // Runs as many fixed frames (each one split into substeps) as the elapsed time covers
+        if (!physicManager.isThreaded())
+            physicManager.update(elapsedTime.count());
 
-            // Decrease lag by the fixed time step
-            lag -= fixedTimeStep;
-        }
         auto t = static_cast<float>(glfwGetTime()); // glfwGetTime returns a double
         transformVertex(app, t);
         transformVertex2(app, t);
         app.onFrame();
     }
 
+    physicManager.stopThread();
     app.onFinish();
 
     return 0;
@@ -0,0 +1,83 @@
+#include <allocationCounter.h>
+
+#ifdef WGPU_PS_CHECK_ALLOCATIONS
+
+#include <Eigen/Core>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+static thread_local std::size_t allocationCount = 0;
+
+std::size_t AllocationCounter::count() {
+    return allocationCount;
+}
+
+//Eigen's switch is only written when it changes, so a physics thread that leaves it alone never
+//races with Eigen code running on the render thread
+static bool setEigenMallocAllowed(bool allowed) {
+    bool previous = Eigen::internal::is_malloc_allowed();
+    if (previous != allowed)
+        Eigen::internal::set_is_malloc_allowed(allowed);
+    return previous;
+}
+
+NoAllocationScope::NoAllocationScope(bool forbidEigenMalloc)
+        : startCount(allocationCount),
+          eigenMallocAllowed(Eigen::internal::is_malloc_allowed()) {
+    if (forbidEigenMalloc)
+        setEigenMallocAllowed(false);
+}
+
+NoAllocationScope::~NoAllocationScope() {
+    setEigenMallocAllowed(eigenMallocAllowed);
+    assert(allocationCount == startCount && "heap allocation inside a NoAllocationScope");
+}
+
+AllocationAllowedScope::AllocationAllowedScope() : startCount(allocationCount),
+                                                   eigenMallocAllowed(setEigenMallocAllowed(true)) {}
+
+AllocationAllowedScope::~AllocationAllowedScope() {
+    setEigenMallocAllowed(eigenMallocAllowed);
+    allocationCount = startCount;
+}
+
+//Counting replacements of the global allocation functions. The remaining forms of operator
+//new forward to these by default, and the deletes pair them with std::free.
+void* operator new(std::size_t size) {
+    allocationCount++;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    allocationCount++;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+#else
+
+std::size_t AllocationCounter::count() {
+    return 0;
+}
+
+#endif
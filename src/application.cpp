@@ -75,6 +75,7 @@ void Application::onFrame() {
     renderPassDesc.nextInChain = nullptr;
 
     //Write Buffers
+    physicManager.syncRenderState();
     m_queue.writeBuffer(m_vertexBuffer, 0, m_vertexData[0].positions.data(),
                         m_vertexData[0].positions.size() * sizeof(float));
     m_queue.writeBuffer(m_normalBuffer, 0, m_vertexData[0].renderNormals.data(),
@@ -419,7 +420,7 @@ void Application::onKeyPressed(int key, int action) {
 
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) glfwSetWindowShouldClose(m_window, true);
     if (key == GLFW_KEY_P && action == GLFW_PRESS) {
-        physicManager.unPause();
+        physicManager.sendCommand(SimulationCommand::TogglePause);
     }
 
 //    float cameraSpeed = camSpeed * deltaTime;
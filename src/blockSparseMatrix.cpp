@@ -0,0 +1,110 @@
+#include <blockSparseMatrix.h>
+#include <algorithm>
+
+//Block rows per task of the products
+constexpr int BlockRowGrain = 256;
+
+void BlockSparseMatrix::setPattern(const SparseMatrixR &m, bool upperOnly, ThreadPool &pool) {
+
+    threadPool = &pool;
+    symmetric = upperOnly;
+    int blockRows = (int) m.rows() / 3;
+
+    //Gather the block columns of every block row
+    std::vector<std::vector<int>> rowBlocks(blockRows);
+    for (int col = 0; col < m.outerSize(); col++) {
+        for (SparseMatrixR::InnerIterator it(m, col); it; ++it) {
+            int blockRow = (int) it.row() / 3;
+            int blockCol = col / 3;
+            if (symmetric && blockCol < blockRow)
+                continue;
+            rowBlocks[blockRow].push_back(blockCol);
+        }
+    }
+
+    rowOffsets.assign(blockRows + 1, 0);
+    blockCols.clear();
+    for (int i = 0; i < blockRows; i++) {
+        std::vector<int> &row = rowBlocks[i];
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+        blockCols.insert(blockCols.end(), row.begin(), row.end());
+        rowOffsets[i + 1] = (int) blockCols.size();
+    }
+    values.assign(9 * blockCols.size(), 0.0f);
+
+    //Transposed index of the off diagonal blocks, so a block row can also gather its lower blocks
+    lowerOffsets.assign(blockRows + 1, 0);
+    lowerBlocks.clear();
+    lowerRows.clear();
+    if (symmetric) {
+        for (int i = 0; i < blockRows; i++) {
+            for (int k = rowOffsets[i]; k < rowOffsets[i + 1]; k++) {
+                if (blockCols[k] != i)
+                    lowerOffsets[blockCols[k] + 1]++;
+            }
+        }
+        for (int i = 0; i < blockRows; i++)
+            lowerOffsets[i + 1] += lowerOffsets[i];
+        lowerBlocks.resize(lowerOffsets[blockRows]);
+        lowerRows.resize(lowerOffsets[blockRows]);
+        std::vector<int> next(lowerOffsets.begin(), lowerOffsets.end() - 1);
+        for (int i = 0; i < blockRows; i++) {
+            for (int k = rowOffsets[i]; k < rowOffsets[i + 1]; k++) {
+                int j = blockCols[k];
+                if (j == i)
+                    continue;
+                lowerBlocks[next[j]] = k;
+                lowerRows[next[j]] = i;
+                next[j]++;
+            }
+        }
+    }
+
+    valueMap.assign(m.nonZeros(), -1);
+    int k = 0;
+    for (int col = 0; col < m.outerSize(); col++) {
+        for (SparseMatrixR::InnerIterator it(m, col); it; ++it, k++) {
+            int blockRow = (int) it.row() / 3;
+            int blockCol = col / 3;
+            if (symmetric && blockCol < blockRow)
+                continue;
+            auto begin = blockCols.begin() + rowOffsets[blockRow];
+            auto end = blockCols.begin() + rowOffsets[blockRow + 1];
+            int block = (int) (std::lower_bound(begin, end, blockCol) - blockCols.begin());
+            valueMap[k] = 9 * block + 3 * ((int) it.row() % 3) + col % 3;
+        }
+    }
+}
+
+void BlockSparseMatrix::setValues(const SparseMatrixR &m) {
+
+    //The compressed matrix stores its values in the same order setPattern() walked them
+    const float* source = m.valuePtr();
+    for (int k = 0; k < (int) valueMap.size(); k++) {
+        if (valueMap[k] >= 0)
+            values[valueMap[k]] = source[k];
+    }
+}
+
+void BlockSparseMatrix::multiply(const float* x, float* y, float alpha) const {
+
+    int blockRows = numBlockRows();
+    int chunks = (blockRows + BlockRowGrain - 1) / BlockRowGrain;
+    threadPool->parallelFor(chunks, [&](int chunk) {
+        int end = std::min(blockRows, (chunk + 1) * BlockRowGrain);
+        for (int i = chunk * BlockRowGrain; i < end; i++) {
+            Eigen::Vector3f yi = Eigen::Vector3f::Zero();
+            for (int k = rowOffsets[i]; k < rowOffsets[i + 1]; k++) {
+                Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> block(&values[9 * k]);
+                yi.noalias() += block * Eigen::Map<const Eigen::Vector3f>(x + 3 * blockCols[k]);
+            }
+            //The lower triangle is the transpose of the stored upper blocks
+            for (int k = lowerOffsets[i]; k < lowerOffsets[i + 1]; k++) {
+                Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> block(&values[9 * lowerBlocks[k]]);
+                yi.noalias() += block.transpose() * Eigen::Map<const Eigen::Vector3f>(x + 3 * lowerRows[k]);
+            }
+            Eigen::Map<Eigen::Vector3f>(y + 3 * i) += alpha * yi;
+        }
+    });
+}
@@ -0,0 +1,326 @@
+#include <bvh.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Triangles per task of the parallel passes. The passes over the internal nodes, one fewer than the
+//triangles, use the same split.
+constexpr int TriangleGrain = 1024;
+
+static inline int leadingZeros(std::uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return x == 0 ? 64 : __builtin_clzll(x);
+#else
+    int n = 0;
+    for (std::uint64_t bit = std::uint64_t(1) << 63; bit != 0 && !(x & bit); bit >>= 1)
+        n++;
+    return n;
+#endif
+}
+
+//Spread the 10 low bits of x so that there are two zero bits between each of them
+static inline std::uint32_t expandBits(std::uint32_t x) {
+    x = (x * 0x00010001u) & 0xFF0000FFu;
+    x = (x * 0x00000101u) & 0x0F00F00Fu;
+    x = (x * 0x00000011u) & 0xC30C30C3u;
+    x = (x * 0x00000005u) & 0x49249249u;
+    return x;
+}
+
+static inline float boxArea(const float* box) {
+    float dx = box[3] - box[0];
+    float dy = box[4] - box[1];
+    float dz = box[5] - box[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+void TriangleBVH::build(const Eigen::Ref<const VectorXR>& positions, const Vectori& tris, ThreadPool& pool) {
+
+    numTriangles = (int) tris.size() / 3;
+    triangles.assign(tris.data(), tris.data() + tris.size());
+
+    int numNodes = std::max(0, 2 * numTriangles - 1);
+    bounds.resize(6 * numNodes);
+    left.resize(std::max(0, numTriangles - 1));
+    right.resize(std::max(0, numTriangles - 1));
+    leafTriangles.resize(numTriangles);
+    keys.resize(numTriangles);
+    int triangleChunks = (numTriangles + TriangleGrain - 1) / TriangleGrain;
+    chunkBounds.resize(6 * triangleChunks);
+    chunkArea.resize((std::max(0, numTriangles - 1) + TriangleGrain - 1) / TriangleGrain);
+    levelNodes.resize(std::max(0, numTriangles - 1));
+    levelStart.reserve(MaxDepth + 1);
+    builds = 0;
+
+    rebuild(positions, pool);
+}
+
+void TriangleBVH::rebuild(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool) {
+    rebuild(positions, positions, pool);
+}
+
+void TriangleBVH::rebuild(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end,
+                          ThreadPool& pool) {
+
+    if (numTriangles == 0)
+        return;
+
+    //The tree is ordered by the final positions
+    const float* pos = end.data();
+    auto center = [&](int t) {
+        return (Eigen::Map<const Eigen::Vector3f>(pos + 3 * triangles[3 * t]) +
+                Eigen::Map<const Eigen::Vector3f>(pos + 3 * triangles[3 * t + 1]) +
+                Eigen::Map<const Eigen::Vector3f>(pos + 3 * triangles[3 * t + 2])) / 3.0f;
+    };
+
+    //Bounds of the triangle centers, reduced over fixed chunks
+    int triangleChunks = (numTriangles + TriangleGrain - 1) / TriangleGrain;
+    pool.parallelFor(triangleChunks, [&](int chunk) {
+        Eigen::Vector3f lo = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+        Eigen::Vector3f hi = -lo;
+        int last = std::min(numTriangles, (chunk + 1) * TriangleGrain);
+        for (int t = chunk * TriangleGrain; t < last; t++) {
+            Eigen::Vector3f c = center(t);
+            lo = lo.cwiseMin(c);
+            hi = hi.cwiseMax(c);
+        }
+        Eigen::Vector3f::Map(&chunkBounds[6 * chunk]) = lo;
+        Eigen::Vector3f::Map(&chunkBounds[6 * chunk + 3]) = hi;
+    });
+    Eigen::Vector3f lo = Eigen::Map<const Eigen::Vector3f>(&chunkBounds[0]);
+    Eigen::Vector3f hi = Eigen::Map<const Eigen::Vector3f>(&chunkBounds[3]);
+    for (int chunk = 1; chunk < triangleChunks; chunk++) {
+        lo = lo.cwiseMin(Eigen::Map<const Eigen::Vector3f>(&chunkBounds[6 * chunk]));
+        hi = hi.cwiseMax(Eigen::Map<const Eigen::Vector3f>(&chunkBounds[6 * chunk + 3]));
+    }
+    Eigen::Vector3f scale = 1024.0f * (hi - lo).cwiseMax(1e-20f).cwiseInverse();
+
+    //30 bit Morton codes on a 1024^3 grid over the centers. The triangle index in the low bits
+    //makes the keys unique, so equal codes need no special case when building the tree.
+    pool.parallelFor(triangleChunks, [&](int chunk) {
+        int last = std::min(numTriangles, (chunk + 1) * TriangleGrain);
+        for (int t = chunk * TriangleGrain; t < last; t++) {
+            Eigen::Vector3f cell = (center(t) - lo).cwiseProduct(scale).cwiseMax(0.0f).cwiseMin(1023.0f);
+            std::uint32_t code = (expandBits((std::uint32_t) cell[0]) << 2) |
+                                 (expandBits((std::uint32_t) cell[1]) << 1) |
+                                 expandBits((std::uint32_t) cell[2]);
+            keys[t] = ((std::uint64_t) code << 32) | (std::uint32_t) t;
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+    for (int k = 0; k < numTriangles; k++)
+        leafTriangles[k] = (int) (keys[k] & 0xFFFFFFFFu);
+
+    //Every internal node finds its range and split from the keys alone
+    int internalChunks = (numTriangles - 1 + TriangleGrain - 1) / TriangleGrain;
+    pool.parallelFor(internalChunks, [&](int chunk) {
+        int last = std::min(numTriangles - 1, (chunk + 1) * TriangleGrain);
+        for (int i = chunk * TriangleGrain; i < last; i++)
+            buildInternalNode(i);
+    });
+
+    computeLevels();
+    builds++;
+    refit(start, end, pool);
+    builtArea = currentArea;
+}
+
+int TriangleBVH::commonPrefix(int i, int j) const {
+    if (j < 0 || j >= numTriangles)
+        return -1;
+    return leadingZeros(keys[i] ^ keys[j]);
+}
+
+void TriangleBVH::buildInternalNode(int i) {
+
+    //Direction of the range of node i, and the prefix it shares with the other side
+    int d = commonPrefix(i, i + 1) > commonPrefix(i, i - 1) ? 1 : -1;
+    int minPrefix = commonPrefix(i, i - d);
+
+    //Other end of the range: exponential search, then binary search
+    int maxLength = 2;
+    while (commonPrefix(i, i + maxLength * d) > minPrefix)
+        maxLength *= 2;
+    int length = 0;
+    for (int t = maxLength / 2; t >= 1; t /= 2) {
+        if (commonPrefix(i, i + (length + t) * d) > minPrefix)
+            length += t;
+    }
+    int j = i + length * d;
+
+    //Split: the last key that shares more than the prefix of the whole range with key i
+    int nodePrefix = commonPrefix(i, j);
+    int split = 0;
+    for (int t = length; t > 1;) {
+        t = (t + 1) / 2;
+        if (commonPrefix(i, i + (split + t) * d) > nodePrefix)
+            split += t;
+    }
+    int gamma = i + split * d + std::min(d, 0);
+
+    int leafOffset = numTriangles - 1;
+    left[i] = std::min(i, j) == gamma ? leafOffset + gamma : gamma;
+    right[i] = std::max(i, j) == gamma + 1 ? leafOffset + gamma + 1 : gamma + 1;
+}
+
+void TriangleBVH::computeLevels() {
+
+    //Breadth first order of the internal nodes: each level only has children in the next one
+    levelStart.clear();
+    levelStart.push_back(0);
+    if (numTriangles < 2)
+        return;
+    levelNodes[0] = 0;
+    int end = 1;
+    for (int begin = 0; begin < end;) {
+        levelStart.push_back(end);
+        int levelEnd = end;
+        for (int k = begin; k < levelEnd; k++) {
+            int node = levelNodes[k];
+            if (!isLeaf(left[node]))
+                levelNodes[end++] = left[node];
+            if (!isLeaf(right[node]))
+                levelNodes[end++] = right[node];
+        }
+        begin = levelEnd;
+    }
+}
+
+void TriangleBVH::refitLeaves(const float* start, const float* end, ThreadPool& pool) {
+
+    int leafOffset = numTriangles - 1;
+    int triangleChunks = (numTriangles + TriangleGrain - 1) / TriangleGrain;
+    pool.parallelFor(triangleChunks, [&](int chunk) {
+        int last = std::min(numTriangles, (chunk + 1) * TriangleGrain);
+        for (int k = chunk * TriangleGrain; k < last; k++) {
+            const int* tri = &triangles[3 * leafTriangles[k]];
+            Eigen::Map<const Eigen::Vector3f> a(start + 3 * tri[0]), b(start + 3 * tri[1]), c(start + 3 * tri[2]);
+            Eigen::Map<const Eigen::Vector3f> d(end + 3 * tri[0]), e(end + 3 * tri[1]), f(end + 3 * tri[2]);
+            float* box = &bounds[6 * (leafOffset + k)];
+            Eigen::Vector3f::Map(box) = a.cwiseMin(b).cwiseMin(c).cwiseMin(d.cwiseMin(e).cwiseMin(f));
+            Eigen::Vector3f::Map(box + 3) = a.cwiseMax(b).cwiseMax(c).cwiseMax(d.cwiseMax(e).cwiseMax(f));
+        }
+    });
+}
+
+void TriangleBVH::refit(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool) {
+    refit(positions, positions, pool);
+}
+
+void TriangleBVH::refit(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end,
+                        ThreadPool& pool) {
+
+    if (numTriangles == 0)
+        return;
+
+    refitLeaves(start.data(), end.data(), pool);
+
+    //Deepest level first, so the children of a node are always up to date
+    int numLevels = (int) levelStart.size() - 1;
+    for (int level = numLevels - 1; level >= 0; level--) {
+        int begin = levelStart[level];
+        int count = levelStart[level + 1] - begin;
+        int chunks = (count + TriangleGrain - 1) / TriangleGrain;
+        pool.parallelFor(chunks, [&](int chunk) {
+            int last = std::min(count, (chunk + 1) * TriangleGrain);
+            for (int k = chunk * TriangleGrain; k < last; k++) {
+                int node = levelNodes[begin + k];
+                const float* a = &bounds[6 * left[node]];
+                const float* b = &bounds[6 * right[node]];
+                float* box = &bounds[6 * node];
+                for (int axis = 0; axis < 3; axis++) {
+                    box[axis] = std::min(a[axis], b[axis]);
+                    box[axis + 3] = std::max(a[axis + 3], b[axis + 3]);
+                }
+            }
+        });
+    }
+
+    //Total surface of the internal boxes, the cost of traversing the tree
+    int internalChunks = (int) chunkArea.size();
+    pool.parallelFor(internalChunks, [&](int chunk) {
+        float area = 0.0f;
+        int last = std::min(numTriangles - 1, (chunk + 1) * TriangleGrain);
+        for (int node = chunk * TriangleGrain; node < last; node++)
+            area += boxArea(&bounds[6 * node]);
+        chunkArea[chunk] = area;
+    });
+    currentArea = 0.0f;
+    for (float area: chunkArea)
+        currentArea += area;
+}
+
+bool TriangleBVH::update(const Eigen::Ref<const VectorXR>& positions, ThreadPool& pool) {
+    return update(positions, positions, pool);
+}
+
+bool TriangleBVH::update(const Eigen::Ref<const VectorXR>& start, const Eigen::Ref<const VectorXR>& end,
+                         ThreadPool& pool) {
+
+    refit(start, end, pool);
+    if (quality() <= rebuildThreshold)
+        return false;
+    rebuild(start, end, pool);
+    return true;
+}
+
+bool TriangleBVH::raycast(const Eigen::Ref<const VectorXR>& positions, const Eigen::Vector3f& origin,
+                          const Eigen::Vector3f& direction, float maxT, RayHit& hit) const {
+
+    if (numTriangles == 0)
+        return false;
+
+    const float* pos = positions.data();
+    Eigen::Array3f invDirection = direction.array().inverse();
+    hit.t = maxT;
+    hit.triangle = -1;
+
+    int stack[MaxDepth];
+    int top = 0;
+    stack[top++] = root();
+    while (top > 0) {
+        int node = stack[--top];
+
+        //Slab test against the box, up to the closest hit found so far
+        Eigen::Array3f t0 = (Eigen::Map<const Eigen::Array3f>(&bounds[6 * node]) - origin.array()) * invDirection;
+        Eigen::Array3f t1 = (Eigen::Map<const Eigen::Array3f>(&bounds[6 * node + 3]) - origin.array()) * invDirection;
+        float tEnter = std::max(t0.min(t1).maxCoeff(), 0.0f);
+        float tExit = std::min(t0.max(t1).minCoeff(), hit.t);
+        if (tEnter > tExit)
+            continue;
+
+        if (!isLeaf(node)) {
+            stack[top++] = left[node];
+            stack[top++] = right[node];
+            continue;
+        }
+
+        //Moller-Trumbore ray triangle intersection
+        int triangle = leafTriangles[node - (numTriangles - 1)];
+        const int* tri = &triangles[3 * triangle];
+        Eigen::Map<const Eigen::Vector3f> a(pos + 3 * tri[0]), b(pos + 3 * tri[1]), c(pos + 3 * tri[2]);
+        Eigen::Vector3f e1 = b - a;
+        Eigen::Vector3f e2 = c - a;
+        Eigen::Vector3f p = direction.cross(e2);
+        float det = e1.dot(p);
+        if (std::abs(det) < 1e-12f)
+            continue;
+        float invDet = 1.0f / det;
+        Eigen::Vector3f s = origin - a;
+        float u = s.dot(p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            continue;
+        Eigen::Vector3f q = s.cross(e1);
+        float v = direction.dot(q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+        float t = e2.dot(q) * invDet;
+        if (t < 0.0f || t > hit.t)
+            continue;
+        hit.t = t;
+        hit.triangle = triangle;
+        hit.u = u;
+        hit.v = v;
+    }
+    return hit.triangle >= 0;
+}
@@ -0,0 +1,540 @@
+#include <continuousCollision.h>
+#include <collisionUtils.h>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+//Halvings of the interval of each root, enough to reach float precision on [0, 1]
+constexpr int RootIterations = 24;
+
+//Coefficients of f(t) = (a(t) x b(t)) . c(t) for a(t) = a + t * da and so on, which is zero when the
+//three vectors are coplanar
+static void coplanarityCubic(const BatchVectors& a, const BatchVectors& da, const BatchVectors& b,
+                             const BatchVectors& db, const BatchVectors& c, const BatchVectors& dc,
+                             BatchArray* k) {
+    BatchVectors n0 = cross(a, b);
+    BatchVectors n1 = cross(a, db) + cross(da, b);
+    BatchVectors n2 = cross(da, db);
+    k[0] = dot(n0, c);
+    k[1] = dot(n0, dc) + dot(n1, c);
+    k[2] = dot(n1, dc) + dot(n2, c);
+    k[3] = dot(n2, dc);
+}
+
+static inline BatchArray evaluateCubic(const BatchArray* k, const BatchArray& t) {
+    return ((k[3] * t + k[2]) * t + k[1]) * t + k[0];
+}
+
+//Roots of the cubics in [0, 1], earliest first. The interval is split at the roots of the derivative,
+//so that the cubic is monotonic on each of the three parts, and the sign change of every part is
+//bisected. found[j] tells the lanes where part j has a root.
+static void cubicRoots(const BatchArray* k, BatchArray* roots, BatchMask* found) {
+
+    //Roots of 3 k3 t^2 + 2 k2 t + k1, in the stable form that also covers k3 = 0
+    BatchArray qa = 3.0f * k[3];
+    BatchArray qb = 2.0f * k[2];
+    BatchArray discriminant = qb * qb - 4.0f * qa * k[1];
+    BatchArray root = discriminant.max(0.0f).sqrt();
+    BatchArray q = -0.5f * (qb + (qb >= 0.0f).select(root, -root));
+    BatchArray r0 = q / qa;
+    BatchArray r1 = k[1] / q;
+    BatchMask real = discriminant >= 0.0f;
+    r0 = (real && r0.isFinite() && r0 > 0.0f && r0 < 1.0f).select(r0, 1.0f);
+    r1 = (real && r1.isFinite() && r1 > 0.0f && r1 < 1.0f).select(r1, 1.0f);
+
+    BatchArray bounds[4] = {BatchArray::Zero(), r0.min(r1), r0.max(r1), BatchArray::Ones()};
+    for (int part = 0; part < 3; part++) {
+        BatchArray lo = bounds[part];
+        BatchArray hi = bounds[part + 1];
+        BatchArray fLo = evaluateCubic(k, lo);
+        found[part] = hi > lo && fLo * evaluateCubic(k, hi) <= 0.0f;
+        if (!found[part].any())
+            continue;
+        for (int i = 0; i < RootIterations; i++) {
+            BatchArray mid = 0.5f * (lo + hi);
+            BatchArray fMid = evaluateCubic(k, mid);
+            BatchMask left = fLo * fMid <= 0.0f;
+            hi = left.select(mid, hi);
+            lo = left.select(lo, mid);
+            fLo = left.select(fLo, fMid);
+        }
+        roots[part] = 0.5f * (lo + hi);
+    }
+}
+
+//Impulse along the contact normal that leaves the pair gap apart at the end of the step, given the
+//distance at its start. Zero for the lanes that do not cross.
+static BatchArray stoppingImpulse(const CandidateBatch& batch, const BatchArray* weights, BatchVectors& normal,
+                                  const BatchMask& crossing, float gap, float h) {
+
+    BatchVectors startOffset = BatchVectors::Zero();
+    BatchVectors relativeVelocity = BatchVectors::Zero();
+    BatchArray effectiveMassInv = BatchArray::Zero();
+    for (int k = 0; k < 4; k++) {
+        for (int j = 0; j < 3; j++) {
+            startOffset.col(j) += weights[k] * batch.x[k].col(j);
+            relativeVelocity.col(j) += weights[k] * batch.v[k].col(j);
+        }
+        effectiveMassInv += weights[k] * weights[k] * batch.massInv[k];
+    }
+
+    //The normal points to the side the pair started from. Pairs already touching at the start are
+    //sent back against their relative motion.
+    BatchArray startDistance = dot(startOffset, normal);
+    BatchArray normalVelocity = dot(relativeVelocity, normal);
+    BatchArray side = (startDistance.abs() > 1e-3f * gap).select(startDistance, -normalVelocity);
+    BatchArray sign = (side < 0.0f).select(BatchArray::Constant(-1.0f), BatchArray::Constant(1.0f));
+    for (int j = 0; j < 3; j++)
+        normal.col(j) *= sign;
+    startDistance *= sign;
+    normalVelocity *= sign;
+
+    BatchArray target = (gap - startDistance) / h;
+    BatchArray impulse = (target - normalVelocity).max(0.0f) / effectiveMassInv.max(1e-20f);
+    return (crossing && effectiveMassInv > 0.0f).select(impulse, 0.0f);
+}
+
+void ContinuousCollision::initialize(const VectorXR& positions, const Vectori& tris, ThreadPool& pool) {
+
+    numNodes = (int) positions.size() / 3;
+    numTriangles = (int) tris.size() / 3;
+    triangles.assign(tris.data(), tris.data() + tris.size());
+
+    //Unique mesh edges in sorted order, and the edges of every triangle
+    std::vector<std::pair<int, int>> edgeList;
+    edgeList.reserve(triangles.size());
+    for (int t = 0; t < numTriangles; t++) {
+        for (int j = 0; j < 3; j++) {
+            int a = triangles[3 * t + j];
+            int b = triangles[3 * t + (j + 1) % 3];
+            edgeList.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    std::vector<std::pair<int, int>> triangleEdgeList = edgeList;
+    std::sort(edgeList.begin(), edgeList.end());
+    edgeList.erase(std::unique(edgeList.begin(), edgeList.end()), edgeList.end());
+
+    numEdges = (int) edgeList.size();
+    edges.resize(2 * numEdges);
+    float totalLength = 0.0f;
+    for (int e = 0; e < numEdges; e++) {
+        edges[2 * e] = edgeList[e].first;
+        edges[2 * e + 1] = edgeList[e].second;
+        totalLength += (positions.segment<3>(3 * edgeList[e].first) - positions.segment<3>(3 * edgeList[e].second)).norm();
+    }
+    triangleEdges.resize(3 * numTriangles);
+    edgeTriangle.assign(numEdges, -1);
+    for (int k = 0; k < 3 * numTriangles; k++) {
+        int e = (int) (std::lower_bound(edgeList.begin(), edgeList.end(), triangleEdgeList[k]) - edgeList.begin());
+        triangleEdges[k] = e;
+        if (edgeTriangle[e] < 0)
+            edgeTriangle[e] = k / 3;
+    }
+
+    float meanEdge = numEdges > 0 ? totalLength / (float) numEdges : 1.0f;
+    gap = gapScale * meanEdge;
+
+    startPos.resize(3 * numNodes);
+    stoppedMassInv.resize(numNodes);
+    chunkStopped.resize((numNodes + NodeGrain - 1) / NodeGrain);
+    edgeBounds.resize(6 * numEdges);
+    bvh.build(positions, tris, pool);
+
+    int nodeChunks = (numNodes + PrimitiveGrain - 1) / PrimitiveGrain;
+    int edgeChunks = (numEdges + PrimitiveGrain - 1) / PrimitiveGrain;
+    int room = candidatesPerPrimitive * PrimitiveGrain;
+    vertexChunkPairs.assign(nodeChunks, std::vector<int>(2 * room));
+    edgeChunkPairs.assign(edgeChunks, std::vector<int>(2 * room));
+    vertexChunkCounts.assign(nodeChunks, 0);
+    edgeChunkCounts.assign(edgeChunks, 0);
+
+    int maxVertexTriangle = nodeChunks * room;
+    int maxEdgeEdge = edgeChunks * room;
+    int maxCandidates = maxVertexTriangle + maxEdgeEdge;
+    candidateNodes.resize(4 * maxCandidates);
+    candidateWeights.resize(4 * maxCandidates);
+    candidateNormals.resize(3 * maxCandidates);
+    candidateImpulses.resize(maxCandidates);
+    nodeEntries.resize(4 * maxCandidates);
+    chunkCollisions.resize((maxVertexTriangle + CandidateGrain - 1) / CandidateGrain +
+                           (maxEdgeEdge + CandidateGrain - 1) / CandidateGrain);
+
+    nodeStart.resize(numNodes + 1);
+    numVertexTriangle = 0;
+    numCandidates = 0;
+    lastCandidates = 0;
+    lastCollisions = 0;
+    lastIterations = 0;
+    lastStoppedNodes = 0;
+    lastDroppedCandidates = 0;
+}
+
+void ContinuousCollision::solve(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                                float h, ThreadPool& pool) {
+
+    lastCollisions = 0;
+    lastIterations = 0;
+    lastStoppedNodes = 0;
+    if (numTriangles == 0)
+        return;
+
+    //The impulses change the velocity over the whole step, so the positions stay at startPos + h * vel
+    startPos.noalias() = pos - h * vel;
+
+    for (int i = 0; i < iterations; i++) {
+        detect(pos, vel.data(), nodeMassInv.data(), h, pool);
+        if (lastCollisions == 0)
+            return;
+        applyImpulses(pos.data(), vel.data(), nodeMassInv.data(), h, pool);
+    }
+
+    //Fail-safe: stop the nodes of the pairs that still cross and fix them, until none does. Only the
+    //pairs with a node that can still move are counted, so every pass stops at least one more node.
+    stoppedMassInv = nodeMassInv;
+    detect(pos, vel.data(), stoppedMassInv.data(), h, pool);
+    while (lastCollisions > 0) {
+        stopNodes(pos.data(), vel.data(), pool);
+        detect(pos, vel.data(), stoppedMassInv.data(), h, pool);
+    }
+}
+
+void ContinuousCollision::detect(const Eigen::Ref<const VectorXR>& pos, const float* vel, const float* massInv,
+                                 float h, ThreadPool& pool) {
+    lastIterations++;
+    bvh.update(startPos, pos, pool);
+    findCandidates(pos.data(), pool);
+    gatherCandidates();
+    computeImpulses(vel, massInv, h, pool);
+}
+
+void ContinuousCollision::findCandidates(const float* pos, ThreadPool& pool) {
+
+    const float* start = startPos.data();
+
+    //Bounds of the edges over the step, grown by the gap
+    int edgeChunks = (numEdges + PrimitiveGrain - 1) / PrimitiveGrain;
+    pool.parallelFor(edgeChunks, [&](int chunk) {
+        int end = std::min(numEdges, (chunk + 1) * PrimitiveGrain);
+        for (int e = chunk * PrimitiveGrain; e < end; e++) {
+            int a = edges[2 * e];
+            int b = edges[2 * e + 1];
+            Eigen::Map<const Eigen::Vector3f> a0(start + 3 * a), a1(pos + 3 * a), b0(start + 3 * b), b1(pos + 3 * b);
+            Eigen::Map<Eigen::Vector3f> lo(&edgeBounds[6 * e]);
+            Eigen::Map<Eigen::Vector3f> hi(&edgeBounds[6 * e + 3]);
+            lo = a0.cwiseMin(a1).cwiseMin(b0.cwiseMin(b1)).array() - gap;
+            hi = a0.cwiseMax(a1).cwiseMax(b0.cwiseMax(b1)).array() + gap;
+        }
+    });
+
+    //Vertex-triangle: the triangles whose swept bounds meet the swept bounds of the vertex
+    pool.parallelFor((int) vertexChunkPairs.size(), [&](int chunk) {
+        std::vector<int>& pairs = vertexChunkPairs[chunk];
+        int room = (int) pairs.size() / 2;
+        int found = 0;
+        int end = std::min(numNodes, (chunk + 1) * PrimitiveGrain);
+        for (int v = chunk * PrimitiveGrain; v < end; v++) {
+            Eigen::Map<const Eigen::Vector3f> p0(start + 3 * v), p1(pos + 3 * v);
+            Eigen::Vector3f lo = p0.cwiseMin(p1).array() - gap;
+            Eigen::Vector3f hi = p0.cwiseMax(p1).array() + gap;
+            bvh.queryBox(lo, hi, [&](int t) {
+                if (triangles[3 * t] == v || triangles[3 * t + 1] == v || triangles[3 * t + 2] == v)
+                    return;
+                if (found < room) {
+                    pairs[2 * found] = v;
+                    pairs[2 * found + 1] = t;
+                }
+                found++;
+            });
+        }
+        vertexChunkCounts[chunk] = found;
+    });
+
+    //Edge-edge: the edges of the triangles met by the swept bounds of an edge. A pair is only kept
+    //by the edge with the lower index, when reached through the first triangle of the other edge.
+    pool.parallelFor((int) edgeChunkPairs.size(), [&](int chunk) {
+        std::vector<int>& pairs = edgeChunkPairs[chunk];
+        int room = (int) pairs.size() / 2;
+        int found = 0;
+        int end = std::min(numEdges, (chunk + 1) * PrimitiveGrain);
+        for (int e = chunk * PrimitiveGrain; e < end; e++) {
+            int a = edges[2 * e];
+            int b = edges[2 * e + 1];
+            Eigen::Map<const Eigen::Array3f> lo(&edgeBounds[6 * e]);
+            Eigen::Map<const Eigen::Array3f> hi(&edgeBounds[6 * e + 3]);
+            bvh.queryBox(lo.matrix(), hi.matrix(), [&](int t) {
+                for (int j = 0; j < 3; j++) {
+                    int other = triangleEdges[3 * t + j];
+                    if (other <= e || edgeTriangle[other] != t)
+                        continue;
+                    int c = edges[2 * other];
+                    int d = edges[2 * other + 1];
+                    if (c == a || c == b || d == a || d == b)
+                        continue;
+                    Eigen::Map<const Eigen::Array3f> otherLo(&edgeBounds[6 * other]);
+                    Eigen::Map<const Eigen::Array3f> otherHi(&edgeBounds[6 * other + 3]);
+                    if ((otherHi < lo).any() || (otherLo > hi).any())
+                        continue;
+                    if (found < room) {
+                        pairs[2 * found] = e;
+                        pairs[2 * found + 1] = other;
+                    }
+                    found++;
+                }
+            });
+        }
+        edgeChunkCounts[chunk] = found;
+    });
+
+    //The pairs a task found past its room were not stored
+    lastDroppedCandidates = 0;
+    for (std::size_t chunk = 0; chunk < vertexChunkPairs.size(); chunk++) {
+        int room = (int) vertexChunkPairs[chunk].size() / 2;
+        lastDroppedCandidates += std::max(0, vertexChunkCounts[chunk] - room);
+        vertexChunkCounts[chunk] = std::min(vertexChunkCounts[chunk], room);
+    }
+    for (std::size_t chunk = 0; chunk < edgeChunkPairs.size(); chunk++) {
+        int room = (int) edgeChunkPairs[chunk].size() / 2;
+        lastDroppedCandidates += std::max(0, edgeChunkCounts[chunk] - room);
+        edgeChunkCounts[chunk] = std::min(edgeChunkCounts[chunk], room);
+    }
+}
+
+void ContinuousCollision::gatherCandidates() {
+
+    numVertexTriangle = 0;
+    for (int count: vertexChunkCounts)
+        numVertexTriangle += count;
+    numCandidates = numVertexTriangle;
+    for (int count: edgeChunkCounts)
+        numCandidates += count;
+    lastCandidates = numCandidates;
+
+    int* nodes = candidateNodes.data();
+    for (std::size_t chunk = 0; chunk < vertexChunkPairs.size(); chunk++) {
+        const std::vector<int>& pairs = vertexChunkPairs[chunk];
+        for (int k = 0; k < vertexChunkCounts[chunk]; k++) {
+            int t = pairs[2 * k + 1];
+            nodes[0] = pairs[2 * k];
+            nodes[1] = triangles[3 * t];
+            nodes[2] = triangles[3 * t + 1];
+            nodes[3] = triangles[3 * t + 2];
+            nodes += 4;
+        }
+    }
+    for (std::size_t chunk = 0; chunk < edgeChunkPairs.size(); chunk++) {
+        const std::vector<int>& pairs = edgeChunkPairs[chunk];
+        for (int k = 0; k < edgeChunkCounts[chunk]; k++) {
+            nodes[0] = edges[2 * pairs[2 * k]];
+            nodes[1] = edges[2 * pairs[2 * k] + 1];
+            nodes[2] = edges[2 * pairs[2 * k + 1]];
+            nodes[3] = edges[2 * pairs[2 * k + 1] + 1];
+            nodes += 4;
+        }
+    }
+
+    countingSort(candidateNodes.data(), 4 * numCandidates, nodeStart, nodeEntries.data());
+}
+
+void ContinuousCollision::computeImpulses(const float* vel, const float* massInv, float h, ThreadPool& pool) {
+
+    int vertexTriangleChunks = (numVertexTriangle + CandidateGrain - 1) / CandidateGrain;
+    int edgeEdgeChunks = (numCandidates - numVertexTriangle + CandidateGrain - 1) / CandidateGrain;
+    pool.parallelFor(vertexTriangleChunks + edgeEdgeChunks, [&](int chunk) {
+        bool vertexTriangle = chunk < vertexTriangleChunks;
+        int begin = vertexTriangle ? chunk * CandidateGrain
+                                   : numVertexTriangle + (chunk - vertexTriangleChunks) * CandidateGrain;
+        int end = std::min(vertexTriangle ? numVertexTriangle : numCandidates, begin + CandidateGrain);
+        for (int first = begin; first < end; first += Batch) {
+            int count = std::min(Batch, end - first);
+            if (vertexTriangle)
+                vertexTriangleBatch(first, count, vel, massInv, h);
+            else
+                edgeEdgeBatch(first, count, vel, massInv, h);
+        }
+        int collisions = 0;
+        for (int c = begin; c < end; c++)
+            collisions += candidateImpulses[c] > 0.0f;
+        chunkCollisions[chunk] = collisions;
+    });
+
+    lastCollisions = 0;
+    for (int chunk = 0; chunk < vertexTriangleChunks + edgeEdgeChunks; chunk++)
+        lastCollisions += chunkCollisions[chunk];
+}
+
+void ContinuousCollision::vertexTriangleBatch(int begin, int count, const float* vel, const float* massInv, float h) {
+
+    CandidateBatch batch(&candidateNodes[4 * begin], count, startPos.data(), vel, massInv);
+    const BatchVectors* x = batch.x;
+    BatchVectors u[4];
+    for (int k = 0; k < 4; k++)
+        u[k] = h * batch.v[k];
+
+    //The vertex is in the plane of the triangle when (x2 - x1) x (x3 - x1) . (x0 - x1) = 0
+    BatchArray cubic[4];
+    coplanarityCubic(x[2] - x[1], u[2] - u[1], x[3] - x[1], u[3] - u[1], x[0] - x[1], u[0] - u[1], cubic);
+    BatchArray roots[3];
+    BatchMask found[3];
+    cubicRoots(cubic, roots, found);
+    if (!(found[0] || found[1] || found[2]).any()) {
+        std::fill(&candidateImpulses[begin], &candidateImpulses[begin] + count, 0.0f);
+        return;
+    }
+
+    //The first of them with the vertex inside the triangle, up to the gap
+    BatchMask crossing = BatchMask::Constant(false);
+    BatchArray wa = BatchArray::Zero(), wb = BatchArray::Zero(), wc = BatchArray::Zero();
+    BatchVectors normal = BatchVectors::Zero();
+    for (int part = 0; part < 3; part++) {
+        BatchVectors xt[4];
+        for (int k = 0; k < 4; k++)
+            for (int j = 0; j < 3; j++)
+                xt[k].col(j) = x[k].col(j) + roots[part] * u[k].col(j);
+        BatchArray a, b, c;
+        triangleBarycentric(xt[0], xt[1], xt[2], xt[3], a, b, c);
+        BatchVectors n = cross(xt[2] - xt[1], xt[3] - xt[1]);
+        BatchArray length = dot(n, n).sqrt();
+        //Barycentric slack of about the gap over the size of the triangle
+        BatchArray tolerance = gap / length.sqrt().max(1e-20f);
+        BatchMask hit = !crossing && found[part] && length > 0.0f && a >= -tolerance && b >= -tolerance &&
+                        c >= -tolerance;
+        wa = hit.select(a, wa);
+        wb = hit.select(b, wb);
+        wc = hit.select(c, wc);
+        for (int j = 0; j < 3; j++)
+            normal.col(j) = hit.select(n.col(j) / length.max(1e-20f), normal.col(j));
+        crossing = crossing || hit;
+    }
+
+    BatchArray weights[4] = {BatchArray::Ones(), -wa, -wb, -wc};
+    BatchArray impulse = stoppingImpulse(batch, weights, normal, crossing, gap, h);
+
+    for (int lane = 0; lane < count; lane++) {
+        int c = begin + lane;
+        for (int k = 0; k < 4; k++)
+            candidateWeights[4 * c + k] = weights[k][lane];
+        for (int j = 0; j < 3; j++)
+            candidateNormals[3 * c + j] = normal(lane, j);
+        candidateImpulses[c] = impulse[lane];
+    }
+}
+
+void ContinuousCollision::edgeEdgeBatch(int begin, int count, const float* vel, const float* massInv, float h) {
+
+    CandidateBatch batch(&candidateNodes[4 * begin], count, startPos.data(), vel, massInv);
+    const BatchVectors* x = batch.x;
+    BatchVectors u[4];
+    for (int k = 0; k < 4; k++)
+        u[k] = h * batch.v[k];
+
+    //The edges are coplanar when (x1 - x0) x (x3 - x2) . (x2 - x0) = 0
+    BatchArray cubic[4];
+    coplanarityCubic(x[1] - x[0], u[1] - u[0], x[3] - x[2], u[3] - u[2], x[2] - x[0], u[2] - u[0], cubic);
+    BatchArray roots[3];
+    BatchMask found[3];
+    cubicRoots(cubic, roots, found);
+    if (!(found[0] || found[1] || found[2]).any()) {
+        std::fill(&candidateImpulses[begin], &candidateImpulses[begin] + count, 0.0f);
+        return;
+    }
+
+    //The first of them with the segments closer than the gap
+    BatchMask crossing = BatchMask::Constant(false);
+    BatchArray s = BatchArray::Zero(), t = BatchArray::Zero();
+    BatchVectors normal = BatchVectors::Zero();
+    for (int part = 0; part < 3; part++) {
+        BatchVectors xt[4];
+        for (int k = 0; k < 4; k++)
+            for (int j = 0; j < 3; j++)
+                xt[k].col(j) = x[k].col(j) + roots[part] * u[k].col(j);
+        BatchArray sPart, tPart;
+        segmentClosestPoints(xt[0], xt[1], xt[2], xt[3], sPart, tPart);
+        BatchVectors offset;
+        for (int j = 0; j < 3; j++)
+            offset.col(j) = xt[0].col(j) + sPart * (xt[1].col(j) - xt[0].col(j)) - xt[2].col(j) -
+                            tPart * (xt[3].col(j) - xt[2].col(j));
+        BatchMask hit = !crossing && found[part] && dot(offset, offset) < gap * gap;
+
+        //Normal of the plane of the two edges, or the direction between them at the start for parallel edges
+        BatchVectors n = cross(xt[1] - xt[0], xt[3] - xt[2]);
+        BatchArray length = dot(n, n).sqrt();
+        BatchVectors startOffset;
+        for (int j = 0; j < 3; j++)
+            startOffset.col(j) = x[0].col(j) + sPart * (x[1].col(j) - x[0].col(j)) - x[2].col(j) -
+                                 tPart * (x[3].col(j) - x[2].col(j));
+        BatchArray startLength = dot(startOffset, startOffset).sqrt();
+        BatchMask parallel = length <= 1e-6f * dot(xt[1] - xt[0], xt[1] - xt[0]).sqrt() *
+                                       dot(xt[3] - xt[2], xt[3] - xt[2]).sqrt();
+        hit = hit && (!parallel || startLength > 0.0f);
+        s = hit.select(sPart, s);
+        t = hit.select(tPart, t);
+        for (int j = 0; j < 3; j++)
+            normal.col(j) = hit.select(parallel.select(startOffset.col(j) / startLength.max(1e-20f),
+                                                       n.col(j) / length.max(1e-20f)), normal.col(j));
+        crossing = crossing || hit;
+    }
+
+    BatchArray weights[4] = {1.0f - s, s, t - 1.0f, -t};
+    BatchArray impulse = stoppingImpulse(batch, weights, normal, crossing, gap, h);
+
+    for (int lane = 0; lane < count; lane++) {
+        int candidate = begin + lane;
+        for (int k = 0; k < 4; k++)
+            candidateWeights[4 * candidate + k] = weights[k][lane];
+        for (int j = 0; j < 3; j++)
+            candidateNormals[3 * candidate + j] = normal(lane, j);
+        candidateImpulses[candidate] = impulse[lane];
+    }
+}
+
+void ContinuousCollision::applyImpulses(float* pos, float* vel, const float* massInv, float h, ThreadPool& pool) {
+
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int i = chunk * NodeGrain; i < end; i++) {
+            if (massInv[i] == 0.0f)
+                continue;
+            Eigen::Vector3f dv = Eigen::Vector3f::Zero();
+            int active = 0;
+            for (int s = nodeStart[i]; s < nodeStart[i + 1]; s++) {
+                int slot = nodeEntries[s];
+                int c = slot / 4;
+                if (candidateImpulses[c] == 0.0f)
+                    continue;
+                dv += candidateWeights[slot] * candidateImpulses[c] * Eigen::Map<const Eigen::Vector3f>(&candidateNormals[3 * c]);
+                active++;
+            }
+            if (active == 0)
+                continue;
+            dv *= massInv[i] / (float) active;
+            Eigen::Map<Eigen::Vector3f>(vel + 3 * i) += dv;
+            Eigen::Map<Eigen::Vector3f>(pos + 3 * i) += h * dv;
+        }
+    });
+}
+
+void ContinuousCollision::stopNodes(float* pos, float* vel, ThreadPool& pool) {
+
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int stopped = 0;
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int i = chunk * NodeGrain; i < end; i++) {
+            if (stoppedMassInv[i] == 0.0f)
+                continue;
+            bool crossing = false;
+            for (int s = nodeStart[i]; s < nodeStart[i + 1] && !crossing; s++)
+                crossing = candidateImpulses[nodeEntries[s] / 4] > 0.0f;
+            if (!crossing)
+                continue;
+            Eigen::Map<Eigen::Vector3f>(vel + 3 * i).setZero();
+            Eigen::Map<Eigen::Vector3f>(pos + 3 * i) = startPos.segment<3>(3 * i);
+            stoppedMassInv[i] = 0.0f;
+            stopped++;
+        }
+        chunkStopped[chunk] = stopped;
+    });
+    for (int stopped: chunkStopped)
+        lastStoppedNodes += stopped;
+}
@@ -0,0 +1,116 @@
+#include <fixedPointAccelerator.h>
+#include <algorithm>
+#include <cmath>
+
+void FixedPointAccelerator::resize(int n) {
+
+    previous.setZero(n);
+    beforePrevious.setZero(n);
+    residual.setZero(n);
+    previousResidual.setZero(n);
+    previousImage.setZero(n);
+    residualDiffs.setZero(n, MaxHistory);
+    imageDiffs.setZero(n, MaxHistory);
+}
+
+void FixedPointAccelerator::begin(const Eigen::Ref<const VectorXR> &q) {
+
+    iteration = 0;
+    numFallbacks = 0;
+    lastUpdateNorm = 0.0f;
+    previous = q;
+    beforePrevious = q;
+    omega = 1.0f;
+    chebyshevStart = chebyshevDelay;
+    historySize = 0;
+    historyNext = 0;
+}
+
+void FixedPointAccelerator::apply(Eigen::Ref<VectorXR> q) {
+
+    float updateNorm = (q - previous).norm();
+    switch (method) {
+        case Acceleration::Chebyshev:
+            applyChebyshev(q, updateNorm);
+            break;
+        case Acceleration::Anderson:
+            applyAnderson(q, updateNorm);
+            break;
+        default:
+            break;
+    }
+
+    beforePrevious = previous;
+    previous = q;
+    lastUpdateNorm = updateNorm;
+    iteration++;
+}
+
+void FixedPointAccelerator::applyChebyshev(Eigen::Ref<VectorXR> q, float updateNorm) {
+
+    //The plain iterations converge linearly, and the ratio between consecutive updates tends to the
+    //spectral radius from below, as the fast modes die out. The estimate keeps the largest ratio seen
+    //over the steps, and is only lowered when the acceleration diverges.
+    if (iteration < chebyshevStart) {
+        if (iteration == chebyshevStart - 1 && lastUpdateNorm > 0.0f)
+            rho = std::max(rho, std::min(updateNorm / lastUpdateNorm, 0.999f));
+        return;
+    }
+
+    if (lastUpdateNorm > 0.0f && updateNorm > divergenceFactor * lastUpdateNorm) {
+        //Keep the plain iterate, and restart with a more conservative radius
+        numFallbacks++;
+        rho *= 0.9f;
+        chebyshevStart = iteration + 1;
+        return;
+    }
+
+    if (iteration == chebyshevStart)
+        omega = 2.0f / (2.0f - rho * rho);
+    else
+        omega = 4.0f / (4.0f - rho * rho * omega);
+
+    q = omega * (underRelaxation * (q - previous) + previous - beforePrevious) + beforePrevious;
+}
+
+void FixedPointAccelerator::applyAnderson(Eigen::Ref<VectorXR> q, float updateNorm) {
+
+    //q holds the image G(q_k) of the last iterate, and the residual is G(q_k) - q_k
+    residual = q - previous;
+
+    if (iteration > 0 && updateNorm > divergenceFactor * lastUpdateNorm) {
+        //Keep the plain iterate and forget the history
+        numFallbacks++;
+        historySize = 0;
+        historyNext = 0;
+    } else if (iteration > 0) {
+        int history = std::clamp(andersonHistory, 1, MaxHistory);
+        historyNext %= history;
+        residualDiffs.col(historyNext) = residual - previousResidual;
+        imageDiffs.col(historyNext) = q - previousImage;
+        historyNext++;
+        historySize = std::min(historySize + 1, history);
+    }
+    previousResidual = residual;
+    previousImage = q;
+
+    if (historySize == 0)
+        return;
+
+    //Least squares combination of the previous residuals, min |residual - residualDiffs * gamma|,
+    //through the (small) regularized normal equations
+    using SmallMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, MaxHistory, MaxHistory>;
+    using SmallVector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, MaxHistory, 1>;
+    SmallMatrix normal(historySize, historySize);
+    SmallVector rhs(historySize);
+    for (int i = 0; i < historySize; i++) {
+        for (int j = 0; j <= i; j++)
+            normal(i, j) = normal(j, i) = residualDiffs.col(i).dot(residualDiffs.col(j));
+        rhs[i] = residualDiffs.col(i).dot(residual);
+    }
+    normal.diagonal().array() += 1e-6f * normal.diagonal().maxCoeff() + 1e-20f;
+    SmallVector gamma = normal.ldlt().solve(rhs);
+
+    for (int i = 0; i < historySize; i++)
+        q -= gamma[i] * imageDiffs.col(i);
+}
@@ -1,60 +1,43 @@
 #include <massSpring.h>
+#include <collisionUtils.h>
+#include <algorithm>
+#include <cmath>
 
 void MassSpring::initialize(int idx) {
 
     fillNodesAndSprings();
     index = idx;
-    float nodeMass = mass / (float) nodes.size();
-    for (int i = 0; i < (int)nodes.size(); i++) {
-        nodes[i].initialize(index + 3 * i, nodeMass, dampingAlpha * nodeMass);
-        //Lo de los fixers
-    }
-
-    for (Spring& spring: springs) {
-        if (spring.springType == SpringType::Stretch)
-            spring.initialize(stiffnessStretch, dampingBeta * stiffnessStretch);
-        else if (spring.springType == SpringType::Bend)
-            spring.initialize(stiffnessBend, dampingBeta * stiffnessBend);
-    }
+    float nodeMassValue = mass / (float) numNodes;
+    nodeMass.setConstant(numNodes, nodeMassValue);
+    nodeMassInv.setConstant(numNodes, 1.0f / nodeMassValue);
+    nodeDamping.setConstant(numNodes, dampingAlpha * nodeMassValue);
+    //The first node of the scene is kept in place: a fixed node behaves as if it had infinite mass
+    if (index == 0)
+        nodeMassInv[0] = 0.0f;
+
+    springs.setParameters(SpringType::Stretch, stiffnessStretch, dampingBeta * stiffnessStretch);
+    springs.setParameters(SpringType::Bend, stiffnessBend, dampingBeta * stiffnessBend);
+
+    if (selfCollision)
+        collisions.initialize(object.positions, object.triangles);
+    if (continuousCollision)
+        continuousCollisions.initialize(object.positions, object.triangles, manager.threadPool);
+    if (trackBVH || objectCollision)
+        bvh.build(object.positions, object.triangles, manager.threadPool);
 }
 
 void MassSpring::fillNodesAndSprings() {
 
     //Generate all the nodes (one per vertex)
-    for (int i = 0; i < object.positions.size(); i += 3) {
-        Vector3R pos(object.positions[i],
-                     object.positions[i + 1],
-                     object.positions[i + 2]);
-
-        nodes.emplace_back(manager, pos);
-    }
-    std::cout << "Nodes: " << nodes.size() << std::endl;
+    numNodes = (int) object.positions.size() / 3;
+    springs.clear();
+    std::cout << "Nodes: " << numNodes << std::endl;
     std::cout << "Vertices: " << object.positions.size() << std::endl;
     std::cout << "Indices: " << object.triangles.size() << std::endl;
 
-    //Read the mesh edges to create the cloth springs.
-    std::unordered_set<Edge, Edge> edgeSet;
-    int bCount = 0;
-    for (int i = 0; i < object.triangles.size(); i += 3) {
-        for (int j = 0; j < 3; j++) {
-            int a = i + j;
-            int b = i + ((j + 1) % 3);
-            int o = i + ((j + 2) % 3);
-
-            Edge edge = {(int)object.triangles[a], (int)object.triangles[b], (int)object.triangles[o]};
-            auto it = edgeSet.insert(edge);
-            if (!it.second) {
-                bCount++;
-                //If the edge already exist we should create a bend spring
-                springs.emplace_back(nodes[edge.o], nodes[it.first->o], SpringType::Bend, manager);
-            }
-        }
-    }
-    std::cout << "Stretch springs: " << edgeSet.size() << " Bend Springs: " << bCount << std::endl;
-    //Once all the edges have been created we just have to create the stretch springs
-    for (auto &it: edgeSet) {
-        springs.emplace_back(nodes[it.a], nodes[it.b], SpringType::Stretch, manager);
-    }
+    springs.addMeshEdges(object.positions, object.triangles);
+    springs.sortByColor(numNodes);
+    std::cout << "Spring colors: " << springs.numColors() << std::endl;
 }
 
 MassSpring::MassSpring(float mass, float stiffnessStretch, float stiffnessBend, float dampingAlpha, float dampingBeta,
@@ -64,70 +47,238 @@ MassSpring::MassSpring(float mass, float stiffnessStretch, float stiffnessBend,
                                                                  manager(manager), object(object) {}
 
 int MassSpring::getNumDoFs() {
-    return 3 * (int) nodes.size();
+    return 3 * numNodes;
+}
+
+void MassSpring::bindState(VectorXR& x, VectorXR& v) {
+
+    //Eigen::Map can only be re-targeted with placement new
+    new (&pos) Eigen::Map<VectorXR>(x.data() + index, getNumDoFs());
+    new (&vel) Eigen::Map<VectorXR>(v.data() + index, getNumDoFs());
+    pos = object.positions;
+    vel.setZero();
 }
 
-void MassSpring::getPosition(VectorXR& position) {
-    for (Node& node: nodes)
-        node.getPosition(position);
+void MassSpring::updateState() {
+    //Spring lengths and directions are evaluated on the fly by the force kernel, so there is
+    //no derived state to refresh.
+}
+
+void MassSpring::getFore(VectorXR& force) {
+
+    ThreadPool& pool = manager.threadPool;
+    float* localForce = force.data() + index;
+
+    //Node forces (gravity and damping), computed over 3xN views of the state
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = chunk * NodeGrain;
+        int count = std::min(NodeGrain, numNodes - begin);
+        Eigen::Map<Eigen::Matrix3Xf> nodeForce(localForce + 3 * begin, 3, count);
+        Eigen::Map<const Eigen::Matrix3Xf> nodeVel(vel.data() + 3 * begin, 3, count);
+        nodeForce.noalias() += manager.gravity * nodeMass.segment(begin, count).transpose();
+        nodeForce -= nodeVel * nodeDamping.segment(begin, count).asDiagonal();
+    });
+
+    //Spring forces, one color at a time. Springs of a color never share a node, so their
+    //chunks can scatter into the force vector concurrently.
+    for (int c = 0; c < springs.numColors(); c++) {
+        int colorBegin = springs.colorOffsets[c];
+        int colorEnd = springs.colorOffsets[c + 1];
+        int springChunks = (colorEnd - colorBegin + SpringGrain - 1) / SpringGrain;
+        pool.parallelFor(springChunks, [&](int chunk) {
+            int begin = colorBegin + chunk * SpringGrain;
+            int end = std::min(colorEnd, begin + SpringGrain);
+            springs.getForces(begin, end, pos.data(), vel.data(), localForce);
+        });
+    }
 }
 
-void MassSpring::setPosition(VectorXR& position) {
+void MassSpring::getForceJacobianPattern(std::vector<TripletR>& pattern) {
 
-    for (Node& node: nodes)
-        node.setPosition(position);
+    for (int i = 0; i < getNumDoFs(); i++)
+        pattern.emplace_back(index + i, index + i, 0.0f);
 
-    for (Spring& spring: springs)
-        spring.updateState();
+    springs.getForceJacobianPattern(index, pattern);
 }
 
-void MassSpring::getVelocity(VectorXR& velocity) {
+void MassSpring::getForceJacobian(SparseMatrixR& dFdx, SparseMatrixR& dFdv) {
 
-    for (Node& node: nodes)
-        node.getVelocity(velocity);
+    //dFdx gets no node term because the node force (gravity) does not depend on its position.
+    for (int i = 0; i < numNodes; i++)
+        for (int j = 0; j < 3; j++)
+            dFdv.coeffRef(index + 3 * i + j, index + 3 * i + j) -= nodeDamping[i];
+
+    springs.getForceJacobians(index, pos.data(), dFdx, dFdv);
 }
 
-void MassSpring::setVelocity(VectorXR& velocity) {
+void MassSpring::getStiffForceJacobianPattern(std::vector<TripletR>& pattern) {
 
-    for (Node& node: nodes)
-        node.setVelocity(velocity);
+    //Only the stretch springs are stiff, bending is orders of magnitude softer
+    springs.getForceJacobianPattern(index, SpringType::Stretch, pattern);
 }
 
-void MassSpring::getFore(VectorXR& force) {
+void MassSpring::getStiffForceJacobian(SparseMatrixR& dFdx) {
 
-    for (Node& node: nodes)
-        node.getForce(force);
+    springs.getStiffnessJacobian(index, SpringType::Stretch, pos.data(), dFdx);
+}
 
-    for (Spring& spring: springs)
-        spring.getForces(force);
+void MassSpring::applyForceJacobian(const Eigen::Ref<const VectorXR>& dv, VectorXR& out, float h) {
+
+    ThreadPool& pool = manager.threadPool;
+    const float* localDv = dv.data() + index;
+    float* localOut = out.data() + index;
+
+    //Node damping, the only node term of the jacobians
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = chunk * NodeGrain;
+        int count = std::min(NodeGrain, numNodes - begin);
+        Eigen::Map<Eigen::Matrix3Xf> nodeOut(localOut + 3 * begin, 3, count);
+        Eigen::Map<const Eigen::Matrix3Xf> nodeDv(localDv + 3 * begin, 3, count);
+        nodeOut -= nodeDv * nodeDamping.segment(begin, count).asDiagonal();
+    });
+
+    //Spring blocks, evaluated on the fly with the same colored chunks as the forces
+    for (int c = 0; c < springs.numColors(); c++) {
+        int colorBegin = springs.colorOffsets[c];
+        int colorEnd = springs.colorOffsets[c + 1];
+        int springChunks = (colorEnd - colorBegin + SpringGrain - 1) / SpringGrain;
+        pool.parallelFor(springChunks, [&](int chunk) {
+            int begin = colorBegin + chunk * SpringGrain;
+            int end = std::min(colorEnd, begin + SpringGrain);
+            springs.applyForceJacobians(begin, end, pos.data(), localDv, h, localOut);
+        });
+    }
 }
 
-void MassSpring::getForceJacobian(MatrixXR& dFdx, MatrixXR& dFdv) {
+float MassSpring::getMaxStiffnessMassRatio(bool excludeStiff) {
+
+    //Gershgorin bound of the eigenvalues of M^-1 K: twice the stiffness of the springs of a node over its mass
+    VectorXR nodeStiffness = VectorXR::Zero(numNodes);
+    for (int s = 0; s < springs.size(); s++) {
+        if (excludeStiff && springs.springType[s] == SpringType::Stretch)
+            continue;
+        nodeStiffness[springs.a[s] / 3] += springs.stiffness[s];
+        nodeStiffness[springs.b[s] / 3] += springs.stiffness[s];
+    }
+    return 2.0f * nodeStiffness.cwiseProduct(nodeMassInv).maxCoeff();
+}
 
-    for (Node& node: nodes)
-        node.getForceJacobian(dFdx, dFdv);
+void MassSpring::solveCollisions(float h) {
 
-    for (Spring& spring: springs)
-        spring.getForceJacobians(dFdx, dFdv);
+    for (auto& obstacle: manager.obstacles)
+        obstacle->resolveContacts(pos, vel, nodeMassInv, obstacleThickness, h, manager.threadPool);
+    if (selfCollision)
+        collisions.solve(pos, vel, nodeMassInv, h, manager.threadPool);
+    if (continuousCollision)
+        continuousCollisions.solve(pos, vel, nodeMassInv, h, manager.threadPool);
+    if (trackBVH || objectCollision)
+        bvh.update(pos, manager.threadPool);
 }
 
-void MassSpring::getMass(MatrixXR & m) {
+void MassSpring::solveObjectCollisions(Simulable& other, float h) {
+
+    auto* cloth = dynamic_cast<MassSpring*>(&other);
+    if (!objectCollision || cloth == nullptr || !cloth->objectCollision)
+        return;
+
+    //The other cloth is a moving surface for the nodes of this one, whose start positions are taken at
+    //pos - h * vel. A node that crossed the plane of a triangle during the step, or ends closer than the
+    //thickness to one, is put back at the thickness on the side it started on, and its velocity relative
+    //to the triangle loses the approaching part.
+    const std::vector<int>& tris = cloth->bvh.getTriangles();
+    const Eigen::Map<VectorXR>& otherPos = cloth->pos;
+    const Eigen::Map<VectorXR>& otherVel = cloth->vel;
+    float thickness = obstacleThickness;
+    int chunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    manager.threadPool.parallelFor(chunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int i = chunk * NodeGrain; i < end; i++) {
+            if (nodeMassInv[i] == 0.0f)
+                continue;
+            Eigen::Vector3f p = pos.segment<3>(3 * i);
+            Eigen::Vector3f start = p - h * vel.segment<3>(3 * i);
+
+            //Crossings go before plain proximity, then the closest triangle wins
+            bool closestCrossed = false;
+            float closestDistance = thickness * thickness;
+            float closestSide = 1.0f;
+            int closestTriangle = -1;
+            Eigen::Vector3f closest = p;
+            Eigen::Vector3f lo = p.cwiseMin(start).array() - thickness;
+            Eigen::Vector3f hi = p.cwiseMax(start).array() + thickness;
+            cloth->bvh.queryBox(lo, hi, [&](int t) {
+                const int* triangle = &tris[3 * t];
+                Eigen::Vector3f a = otherPos.segment<3>(3 * triangle[0]);
+                Eigen::Vector3f b = otherPos.segment<3>(3 * triangle[1]);
+                Eigen::Vector3f c = otherPos.segment<3>(3 * triangle[2]);
+                Eigen::Vector3f q = closestPointOnTriangle(p, a, b, c);
+                float distance = (p - q).squaredNorm();
+
+                Eigen::Vector3f startA = a - h * otherVel.segment<3>(3 * triangle[0]);
+                Eigen::Vector3f startB = b - h * otherVel.segment<3>(3 * triangle[1]);
+                Eigen::Vector3f startC = c - h * otherVel.segment<3>(3 * triangle[2]);
+                float startSide = (start - startA).dot((startB - startA).cross(startC - startA));
+                float endSide = (p - a).dot((b - a).cross(c - a));
+                //Crossed when the sides differ and the closest point is the projection on the plane
+                bool crossed = startSide * endSide < 0.0f &&
+                               distance * (b - a).cross(c - a).squaredNorm() <= 1.0001f * endSide * endSide;
+                bool closer = distance < closestDistance;
+                if (crossed ? closestCrossed && !closer : closestCrossed || !closer)
+                    return;
+                closestCrossed = crossed;
+                closestDistance = distance;
+                closestSide = startSide < 0.0f ? -1.0f : 1.0f;
+                closestTriangle = t;
+                closest = q;
+            });
+            if (closestTriangle < 0)
+                continue;
+
+            //Velocity of the contact point, interpolated from the triangle nodes
+            const int* triangle = &tris[3 * closestTriangle];
+            Eigen::Vector3f a = otherPos.segment<3>(3 * triangle[0]);
+            Eigen::Vector3f e0 = otherPos.segment<3>(3 * triangle[1]) - a;
+            Eigen::Vector3f e1 = otherPos.segment<3>(3 * triangle[2]) - a;
+            Eigen::Vector3f r = closest - a;
+            float d00 = e0.dot(e0);
+            float d01 = e0.dot(e1);
+            float d11 = e1.dot(e1);
+            float denom = std::max(d00 * d11 - d01 * d01, 1e-20f);
+            float wb = (d11 * r.dot(e0) - d01 * r.dot(e1)) / denom;
+            float wc = (d00 * r.dot(e1) - d01 * r.dot(e0)) / denom;
+            Eigen::Vector3f contactVel = (1.0f - wb - wc) * otherVel.segment<3>(3 * triangle[0]) +
+                                         wb * otherVel.segment<3>(3 * triangle[1]) +
+                                         wc * otherVel.segment<3>(3 * triangle[2]);
+
+            Eigen::Vector3f faceNormal = e0.cross(e1).normalized();
+            Eigen::Vector3f offset = p - closest;
+            float distance = std::sqrt(closestDistance);
+            Eigen::Vector3f n = closestSide * offset.dot(faceNormal) < 0.0f || distance < 1e-6f
+                                ? Eigen::Vector3f(closestSide * faceNormal) : Eigen::Vector3f(offset / distance);
+            pos.segment<3>(3 * i) = closest + thickness * n;
+            vel.segment<3>(3 * i) = contactVel + contactVelocity(vel.segment<3>(3 * i) - contactVel, n, objectFriction);
+        }
+    });
 
-    for (Node& node: nodes)
-        node.getMass(m);
+    //The other cloth is resolved against this one next, with the nodes moved here
+    bvh.refit(pos, manager.threadPool);
 }
 
-void MassSpring::getMassInverse(MatrixXR& massInv) {
+void MassSpring::getMass(VectorXR& m) {
 
-    for (Node& node: nodes) {
-        node.getMassInverse(massInv);
-    }
+    //Lumped mass: the 3x3 mass block of a node is diagonal, so we only store its diagonal.
+    Eigen::Map<Eigen::Matrix3Xf>(m.data() + index, 3, numNodes).rowwise() = nodeMass.transpose();
 }
 
-MassSpring::MassSpring(PhysicManager &manager, Object &object) : manager(manager), object(object) {}
+void MassSpring::getMassInverse(VectorXR& massInv) {
 
-void MassSpring::updateObjectState() {
-    getPosition(object.positions);
+    Eigen::Map<Eigen::Matrix3Xf>(massInv.data() + index, 3, numNodes).rowwise() = nodeMassInv.transpose();
 }
 
+MassSpring::MassSpring(PhysicManager &manager, Object &object) : manager(manager), object(object) {}
 
+void MassSpring::updateObjectState(const VectorXR& positions) {
+    object.positions = positions.segment(index, getNumDoFs());
+}
@@ -0,0 +1,90 @@
+#include <meshObstacle.h>
+#include <collisionUtils.h>
+#include <algorithm>
+#include <cmath>
+
+//Cloth nodes per task of the contact pass, smaller than the grain of the cloth passes as every node
+//queries the tree
+constexpr int ContactGrain = 256;
+
+MeshObstacle::MeshObstacle(const Object& object) : positions(object.positions), triangles(object.triangles) {}
+
+void MeshObstacle::initialize(ThreadPool& pool) {
+
+    int numTriangles = (int) triangles.size() / 3;
+    normals.resize(3 * numTriangles);
+    for (int t = 0; t < numTriangles; t++) {
+        Eigen::Map<const Eigen::Vector3f> a(&positions[3 * triangles[3 * t]]);
+        Eigen::Map<const Eigen::Vector3f> b(&positions[3 * triangles[3 * t + 1]]);
+        Eigen::Map<const Eigen::Vector3f> c(&positions[3 * triangles[3 * t + 2]]);
+        Eigen::Vector3f::Map(&normals[3 * t]) = (b - a).cross(c - a).normalized();
+    }
+    bvh.build(positions, triangles, pool);
+}
+
+void MeshObstacle::resolveContacts(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                                   float thickness, float h, ThreadPool& pool) const {
+
+    const std::vector<int>& tris = bvh.getTriangles();
+    int numNodes = (int) nodeMassInv.size();
+    int chunks = (numNodes + ContactGrain - 1) / ContactGrain;
+    pool.parallelFor(chunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * ContactGrain);
+        for (int i = chunk * ContactGrain; i < end; i++) {
+            if (nodeMassInv[i] == 0.0f)
+                continue;
+            Eigen::Vector3f p = pos.segment<3>(3 * i);
+
+            //A node that went through the front of a triangle during the step is put back in front of it.
+            //A static surface makes the vertex-triangle crossing test of CCD a ray cast along the motion.
+            bool inContact = false;
+            Eigen::Vector3f n;
+            TriangleBVH::RayHit hit;
+            Eigen::Vector3f motion = h * vel.segment<3>(3 * i);
+            if (continuous && motion.squaredNorm() > 0.0f && bvh.raycast(positions, p - motion, motion, 1.0f, hit)) {
+                Eigen::Map<const Eigen::Vector3f> faceNormal(&normals[3 * hit.triangle]);
+                if (motion.dot(faceNormal) < 0.0f) {
+                    n = faceNormal;
+                    p = p + (hit.t - 1.0f) * motion + thickness * n;
+                    inContact = true;
+                }
+            }
+
+            //Closest triangle point within the thickness
+            float closestDistance = thickness * thickness;
+            int closestTriangle = -1;
+            Eigen::Vector3f closest = p;
+            bvh.queryBox(p.array() - thickness, p.array() + thickness, [&](int t) {
+                Eigen::Vector3f q = closestPointOnTriangle(p, positions.segment<3>(3 * tris[3 * t]),
+                                                           positions.segment<3>(3 * tris[3 * t + 1]),
+                                                           positions.segment<3>(3 * tris[3 * t + 2]));
+                float distance = (p - q).squaredNorm();
+                if (distance < closestDistance) {
+                    closestDistance = distance;
+                    closestTriangle = t;
+                    closest = q;
+                }
+            });
+
+            //Push out along the face normal from behind the surface, otherwise away from the closest point
+            if (closestTriangle >= 0) {
+                Eigen::Map<const Eigen::Vector3f> faceNormal(&normals[3 * closestTriangle]);
+                Eigen::Vector3f offset = p - closest;
+                float distance = std::sqrt(closestDistance);
+                n = offset.dot(faceNormal) < 0.0f || distance < 1e-6f ? Eigen::Vector3f(faceNormal)
+                                                                       : Eigen::Vector3f(offset / distance);
+                p = closest + thickness * n;
+                inContact = true;
+            }
+            if (!inContact)
+                continue;
+            pos.segment<3>(3 * i) = p;
+            vel.segment<3>(3 * i) = contactVelocity(vel.segment<3>(3 * i), n, friction);
+        }
+    });
+}
+
+bool MeshObstacle::raycast(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float maxT,
+                           TriangleBVH::RayHit& hit) const {
+    return bvh.raycast(positions, origin, direction, maxT, hit);
+}
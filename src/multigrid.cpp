@@ -0,0 +1,256 @@
+#include <multigrid.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+//Columns per task of the parallel sparse products
+constexpr int ColumnGrain = 256;
+
+void SparseProductPlan::build(const SparseMatrixR &left, const SparseMatrixR &right, SparseMatrixR &out) {
+
+    //The operands may hold explicit zeros, so the pattern comes from a product of ones
+    SparseMatrixR leftOnes = left;
+    SparseMatrixR rightOnes = right;
+    leftOnes.coeffs().setOnes();
+    rightOnes.coeffs().setOnes();
+    out = leftOnes * rightOnes;
+    out.makeCompressed();
+
+    columnTerms.assign(out.outerSize() + 1, 0);
+    outIndex.clear();
+    leftIndex.clear();
+    rightIndex.clear();
+    for (int j = 0; j < right.outerSize(); j++) {
+        const int* outBegin = out.innerIndexPtr() + out.outerIndexPtr()[j];
+        const int* outEnd = out.innerIndexPtr() + out.outerIndexPtr()[j + 1];
+        for (int r = right.outerIndexPtr()[j]; r < right.outerIndexPtr()[j + 1]; r++) {
+            int k = right.innerIndexPtr()[r];
+            for (int l = left.outerIndexPtr()[k]; l < left.outerIndexPtr()[k + 1]; l++) {
+                int row = left.innerIndexPtr()[l];
+                outIndex.push_back((int) (std::lower_bound(outBegin, outEnd, row) - out.innerIndexPtr()));
+                leftIndex.push_back(l);
+                rightIndex.push_back(r);
+            }
+        }
+        columnTerms[j + 1] = (int) outIndex.size();
+    }
+}
+
+void SparseProductPlan::apply(const SparseMatrixR &left, const SparseMatrixR &right, SparseMatrixR &out,
+                              ThreadPool &pool) const {
+
+    const float* leftValues = left.valuePtr();
+    const float* rightValues = right.valuePtr();
+    float* outValues = out.valuePtr();
+    int columns = (int) out.outerSize();
+    int chunks = (columns + ColumnGrain - 1) / ColumnGrain;
+    pool.parallelFor(chunks, [&](int chunk) {
+        int begin = chunk * ColumnGrain;
+        int end = std::min(columns, begin + ColumnGrain);
+        std::fill(outValues + out.outerIndexPtr()[begin], outValues + out.outerIndexPtr()[end], 0.0f);
+        for (int t = columnTerms[begin]; t < columnTerms[end]; t++)
+            outValues[outIndex[t]] += leftValues[leftIndex[t]] * rightValues[rightIndex[t]];
+    });
+}
+
+void MultigridPreconditioner::setup(const SparseMatrixR &A, const Eigen::Ref<const VectorXR> &positions,
+                                    ThreadPool &pool) {
+
+    threadPool = &pool;
+    levels.clear();
+    //Levels point to the operators of the previous ones, so they must never be reallocated
+    levels.reserve(maxLevels);
+    levels.emplace_back();
+    levels[0].A = &A;
+
+    int numNodes = (int) A.rows() / 3;
+    Eigen::Matrix3Xf nodePos = Eigen::Map<const Eigen::Matrix3Xf>(positions.data(), 3, numNodes);
+
+    //Mean length of the mesh edges, from the node couplings of the system
+    double edgeSum = 0.0;
+    int edgeCount = 0;
+    for (int col = 0; col < A.outerSize(); col += 3) {
+        for (SparseMatrixR::InnerIterator it(A, col); it; ++it) {
+            if (it.row() % 3 != 0 || it.row() == col)
+                continue;
+            edgeSum += (nodePos.col(it.row() / 3) - nodePos.col(col / 3)).norm();
+            edgeCount++;
+        }
+    }
+
+    float cell = edgeCount > 0 ? 2.0f * (float) (edgeSum / edgeCount) : 0.0f;
+    while (cell > 0.0f && (int) levels.size() < maxLevels && numNodes > coarsestNodes) {
+
+        //Cluster the nodes of the level on a grid. The coarse node is the centroid of its cluster.
+        Eigen::Vector3f origin = nodePos.rowwise().minCoeff();
+        std::unordered_map<long long, int> cells;
+        std::vector<Eigen::Vector3i> nodeCell(numNodes);
+        std::vector<Eigen::Vector3f> coarseSum;
+        std::vector<int> coarseCount;
+        auto key = [](const Eigen::Vector3i &c) {
+            return ((long long) (c.x() & 0x1FFFFF) << 42) | ((long long) (c.y() & 0x1FFFFF) << 21) |
+                   (long long) (c.z() & 0x1FFFFF);
+        };
+        for (int i = 0; i < numNodes; i++) {
+            nodeCell[i] = ((nodePos.col(i) - origin) / cell).array().floor().cast<int>();
+            auto it = cells.emplace(key(nodeCell[i]), (int) coarseSum.size());
+            if (it.second) {
+                coarseSum.emplace_back(Eigen::Vector3f::Zero());
+                coarseCount.push_back(0);
+            }
+            coarseSum[it.first->second] += nodePos.col(i);
+            coarseCount[it.first->second]++;
+        }
+        int numCoarse = (int) coarseSum.size();
+
+        //A grid too fine for the level barely reduces it, retry with bigger cells
+        if (numCoarse > 0.8f * numNodes) {
+            cell *= 2.0f;
+            continue;
+        }
+
+        Eigen::Matrix3Xf coarsePos(3, numCoarse);
+        for (int c = 0; c < numCoarse; c++)
+            coarsePos.col(c) = coarseSum[c] / (float) coarseCount[c];
+
+        //Each node interpolates the nearby coarse nodes with a linear falloff. Its own cluster
+        //always has some weight, so every coarse node is reached.
+        std::vector<TripletR> triplets;
+        float radius = 1.5f * cell;
+        for (int i = 0; i < numNodes; i++) {
+            int own = cells[key(nodeCell[i])];
+            int first = (int) triplets.size();
+            float weightSum = 0.0f;
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        auto it = cells.find(key(nodeCell[i] + Eigen::Vector3i(dx, dy, dz)));
+                        if (it == cells.end())
+                            continue;
+                        int c = it->second;
+                        float w = std::max(0.0f, 1.0f - (nodePos.col(i) - coarsePos.col(c)).norm() / radius);
+                        if (c == own)
+                            w = std::max(w, 0.25f);
+                        if (w == 0.0f)
+                            continue;
+                        triplets.emplace_back(i, c, w);
+                        weightSum += w;
+                    }
+                }
+            }
+            //Normalized weights interpolate constants exactly
+            for (int t = first; t < (int) triplets.size(); t++)
+                triplets[t] = TripletR(i, triplets[t].col(), triplets[t].value() / weightSum);
+        }
+
+        //Same weights for the three coordinates
+        std::vector<TripletR> triplets3;
+        for (const TripletR &t: triplets)
+            for (int a = 0; a < 3; a++)
+                triplets3.emplace_back(3 * t.row() + a, 3 * t.col() + a, t.value());
+
+        int l = (int) levels.size() - 1;
+        Level &level = levels[l];
+        level.P.resize(3 * numNodes, 3 * numCoarse);
+        level.P.setFromTriplets(triplets3.begin(), triplets3.end());
+        level.P.makeCompressed();
+        level.R = level.P.transpose();
+        level.R.makeCompressed();
+
+        levels.emplace_back();
+        Level &coarse = levels.back();
+        levels[l].apPlan.build(*levels[l].A, levels[l].P, levels[l].AP);
+        levels[l].galerkinPlan.build(levels[l].R, levels[l].AP, coarse.coarseA);
+        coarse.A = &coarse.coarseA;
+
+        nodePos = coarsePos;
+        numNodes = numCoarse;
+        cell *= 2.0f;
+    }
+
+    for (Level &level: levels) {
+        int n = (int) level.A->rows();
+        level.diagonalInv.setZero(n);
+        level.x.setZero(n);
+        level.b.setZero(n);
+        level.r.setZero(n);
+    }
+    int coarsestRows = (int) levels.back().A->rows();
+    coarsestDirect = coarsestRows <= 3 * coarsestNodes;
+    coarsestMatrix.setZero(coarsestDirect ? coarsestRows : 0, coarsestDirect ? coarsestRows : 0);
+    coarsestSolver = Eigen::LDLT<Eigen::MatrixXf>(coarsestMatrix.rows());
+}
+
+MultigridPreconditioner &MultigridPreconditioner::compute(const SparseMatrixR &A) {
+
+    levels[0].A = &A;
+    for (int l = 0; l + 1 < numLevels(); l++) {
+        Level &level = levels[l];
+        level.apPlan.apply(*level.A, level.P, level.AP, *threadPool);
+        level.galerkinPlan.apply(level.R, level.AP, levels[l + 1].coarseA, *threadPool);
+    }
+    for (Level &level: levels)
+        level.diagonalInv = level.A->diagonal().cwiseInverse();
+
+    //The dense factorization works in the storage sized by setup()
+    if (coarsestDirect) {
+        coarsestMatrix = *levels.back().A;
+        coarsestSolver.compute(coarsestMatrix);
+    }
+    return *this;
+}
+
+void MultigridPreconditioner::vCycle(int l) const {
+
+    const Level &level = levels[l];
+
+    //Coarsest level: direct solve with the cached factors, or more smoothing if it is too big
+    if (l == numLevels() - 1) {
+        if (coarsestDirect) {
+            level.x = coarsestSolver.solve(level.b);
+        } else {
+            level.x.setZero();
+            smooth(level, coarsestSweeps);
+        }
+        return;
+    }
+
+    const Level &coarse = levels[l + 1];
+    level.x.setZero();
+    smooth(level, preSmoothing);
+
+    //Restrict the residual, solve the coarse correction and interpolate it back
+    transposeProduct(*level.A, level.x, level.r);
+    level.r = level.b - level.r;
+    transposeProduct(level.P, level.r, coarse.b);
+    vCycle(l + 1);
+    transposeProduct(level.R, coarse.x, level.r);
+    level.x += level.r;
+
+    smooth(level, postSmoothing);
+}
+
+void MultigridPreconditioner::smooth(const Level &level, int sweeps) const {
+
+    for (int s = 0; s < sweeps; s++) {
+        transposeProduct(*level.A, level.x, level.r);
+        level.x.array() += jacobiWeight * level.diagonalInv.array() * (level.b - level.r).array();
+    }
+}
+
+void MultigridPreconditioner::transposeProduct(const SparseMatrixR &M, const VectorXR &x, VectorXR &out) const {
+
+    //The level systems are symmetric, so A^T x is also A x
+    int columns = (int) M.outerSize();
+    int chunks = (columns + ColumnGrain - 1) / ColumnGrain;
+    threadPool->parallelFor(chunks, [&](int chunk) {
+        int begin = chunk * ColumnGrain;
+        int end = std::min(columns, begin + ColumnGrain);
+        for (int j = begin; j < end; j++) {
+            float sum = 0.0f;
+            for (SparseMatrixR::InnerIterator it(M, j); it; ++it)
+                sum += it.value() * x[it.row()];
+            out[j] = sum;
+        }
+    });
+}
@@ -1,72 +1,809 @@
 #include <physicmanager.h>
+#include <allocationCounter.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
 
 using VectorXR = Eigen::Matrix<float, Eigen::Dynamic, 1>;
 using MatrixXR = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
 using Vector3R = Eigen::Matrix<float, 3, 1>;
 
+//DoFs per task of the parallel passes over the state
+constexpr int StateGrain = 4096;
+//Free nodes up to which AutoPrecond keeps the block Jacobi preconditioner
+constexpr int AutoPrecondSmallNodes = 1024;
+
 void PhysicManager::initialize() {
+    solverSims.clear();
+    selfIntegratedSims.clear();
+    for (auto& simObj: simObjs) {
+        if (simObj->isSelfIntegrated())
+            selfIntegratedSims.push_back(simObj.get());
+        else
+            solverSims.push_back(simObj.get());
+    }
+
+    //The DoFs of the global integrator go first, so it can work on the head of the state
     numDoFs = 0;
+    for (Simulable* sim: solverSims) {
+        sim->initialize(numDoFs);
+        numDoFs += sim->getNumDoFs();
+    }
+    numSolverDoFs = numDoFs;
+    for (Simulable* sim: selfIntegratedSims) {
+        sim->initialize(numDoFs);
+        numDoFs += sim->getNumDoFs();
+    }
 
-    for (auto& simObj: simObjs) {
-        simObj->initialize(numDoFs);
-        numDoFs += simObj->getNumDoFs();
+    x.resize(numDoFs);
+    v.resize(numDoFs);
+    for (auto& simObj: simObjs)
+        simObj->bindState(x, v);
+
+    for (auto& obstacle: obstacles)
+        obstacle->initialize(threadPool);
+
+    broadphaseSims = solverSims;
+    broadphaseSims.insert(broadphaseSims.end(), selfIntegratedSims.begin(), selfIntegratedSims.end());
+    simStart.clear();
+    int start = 0;
+    for (Simulable* sim: broadphaseSims) {
+        simStart.push_back(start);
+        start += sim->getNumDoFs();
+    }
+    simBounds.assign(6 * broadphaseSims.size(), 0.0f);
+    broadphase.initialize((int) broadphaseSims.size());
+
+    //The mass never changes during the simulation, so it is gathered only once.
+    mass.resize(numSolverDoFs);
+    massInv.resize(numSolverDoFs);
+    for (Simulable* sim: solverSims) {
+        sim->getMass(mass);
+        sim->getMassInverse(massInv);
+    }
+
+    //DoFs with infinite mass are fixed and must be kept out of the implicit solve.
+    fixedDoFs.clear();
+    for (int i = 0; i < numSolverDoFs; i++) {
+        if (massInv[i] == 0.0f)
+            fixedDoFs.push_back(i);
+    }
+
+    //Only the assembled implicit solves store the jacobians. The integration method has to be
+    //chosen before initialize().
+    if (integrationMethod == Integration::Implicit || integrationMethod == Integration::IMEX) {
+        buildJacobianPattern(integrationMethod == Integration::IMEX);
+    } else {
+        dFdx = SparseMatrixR();
+        dFdv = SparseMatrixR();
+        A = SparseMatrixR();
+    }
+    resizeWorkspaces();
+
+    //Explicit forces are only stable for steps below 2 / omega_max (2.8 / omega_max for RK4, whose
+    //stability region reaches further along the imaginary axis). IMEX only integrates the non stiff
+    //forces explicitly, and the implicit methods have no bound.
+    stableTimeStep = std::numeric_limits<float>::infinity();
+    if (integrationMethod != Integration::Implicit && integrationMethod != Integration::ImplicitMatrixFree) {
+        float ratio = 0.0f;
+        for (Simulable* sim: solverSims)
+            ratio = std::max(ratio, sim->getMaxStiffnessMassRatio(integrationMethod == Integration::IMEX));
+        float stabilityLimit = integrationMethod == Integration::RK4 ? 2.8f : 2.0f;
+        if (ratio > 0.0f)
+            stableTimeStep = cflSafety * stabilityLimit / std::sqrt(ratio);
+    }
+    nextTimeStep = std::min({timeStep, maxTimeStep, stableTimeStep});
+    lastTimeStep = 0.0f;
+    lastFrameSteps = 0;
+    rejectedSteps = 0;
+    verletAccelValid = false;
+    substepSize = 0.0f;
+    //The automatic preconditioner choice depends on the meshes, so it is made again
+    activePreconditioner = preconditionerType == PreconditionerType::AutoPrecond ? selectPreconditioner()
+                                                                                 : preconditionerType;
+    renderStates.reset({x, x, std::chrono::steady_clock::now()});
+    renderPositions = x;
+}
+
+void PhysicManager::resizeWorkspaces() {
+
+    if (f.size() == numSolverDoFs)
+        return;
+
+    f.resize(numSolverDoFs);
+    b.resize(numSolverDoFs);
+    tmp.resize(numSolverDoFs);
+    directWork.resize(numSolverDoFs);
+    directDiagonalInv.resize(numSolverDoFs);
+    cg.resize(numSolverDoFs);
+    implicitOperator.resize(numSolverDoFs);
+    savedX.resize(numSolverDoFs);
+    savedV.resize(numSolverDoFs);
+    singleStepX.resize(numSolverDoFs);
+    stageX0.resize(numSolverDoFs);
+    stageV0.resize(numSolverDoFs);
+    stageSumX.resize(numSolverDoFs);
+    stageSumV.resize(numSolverDoFs);
+    verletAccel.resize(numSolverDoFs);
+}
+
+void PhysicManager::buildJacobianPattern(bool stiffOnly) {
+
+    std::vector<TripletR> pattern;
+    for (int i = 0; i < numSolverDoFs; i++)
+        pattern.emplace_back(i, i, 0.0f); //The mass always lives in the diagonal
+    for (Simulable* sim: solverSims) {
+        if (stiffOnly)
+            sim->getStiffForceJacobianPattern(pattern);
+        else
+            sim->getForceJacobianPattern(pattern);
     }
+
+    dFdx.resize(numSolverDoFs, numSolverDoFs);
+    dFdx.setFromTriplets(pattern.begin(), pattern.end());
+    dFdx.makeCompressed();
+    //IMEX only needs the stiffness jacobian
+    dFdv = stiffOnly ? SparseMatrixR() : dFdx;
+    A = dFdx;
+    //Sizes the preconditioner storage, so computing it during a step does not allocate
+    preconditioner.compute(A);
+    blockA.setPattern(A, true, threadPool);
+    blockJacobi.compute(blockA);
+    gaussSeidel.compute(blockA);
+    //The multigrid hierarchy only depends on the rest geometry and the pattern
+    multigrid.setup(A, x.head(numSolverDoFs), threadPool);
+
+    auto start = std::chrono::steady_clock::now();
+    directSolver.analyzePattern(A);
+    analyzeTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 PhysicManager::PhysicManager() {
     paused = true;
     timeStep = 0.005f;
+    frameTime = 0.033;
+    maxCatchUpFrames = 4;
+    lag = 0.0;
+    droppedTime = 0.0;
+    interpolateRenderState = true;
     gravity = Vector3R(0.0f, -9.8f, 0.0f);
     integrationMethod = Integration::Symplectic;
+    numDoFs = 0;
+    numSolverDoFs = 0;
+    substepSize = 0.0f;
+    solverTolerance = 1e-4f;
+    solverMaxIterations = 200;
+    linearSolver = LinearSolver::IterativeCG;
+    preconditionerType = PreconditionerType::DiagonalPrecond;
+    activePreconditioner = PreconditionerType::DiagonalPrecond;
+    lastPreconditionerTime = 0.0f;
+    analyzeTime = 0.0f;
+    lastFactorizeTime = 0.0f;
+    lastSolveTime = 0.0f;
+    blockSystemMatrix = true;
+    lastSolverIterations = 0;
+    lastSolverError = 0.0f;
+    adaptiveTimeStep = false;
+    minTimeStep = 1e-5f;
+    maxTimeStep = 0.033f;
+    adaptiveTolerance = 1e-4f;
+    cflSafety = 0.9f;
+    stableTimeStep = std::numeric_limits<float>::infinity();
+    lastTimeStep = 0.0f;
+    lastFrameSteps = 0;
+    rejectedSteps = 0;
+    nextTimeStep = timeStep;
+    batchExplicitStages = true;
+    verletAccelValid = false;
+}
+
+PhysicManager::~PhysicManager() {
+    stopThread();
+}
+
+void PhysicManager::startThread() {
+
+    if (isThreaded())
+        return;
+
+    simulationRunning = true;
+    simulationThread = std::thread(&PhysicManager::simulationLoop, this);
+}
+
+void PhysicManager::stopThread() {
+
+    if (!isThreaded())
+        return;
+
+    simulationRunning = false;
+    simulationThread.join();
+}
+
+void PhysicManager::simulationLoop() {
+
+    auto previousTime = std::chrono::steady_clock::now();
+    while (simulationRunning) {
+        auto currentTime = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsedTime = currentTime - previousTime;
+        previousTime = currentTime;
+
+        update(elapsedTime.count());
+
+        //Sleep until the next frame is due
+        double untilNextFrame = paused ? frameTime : frameTime - lag;
+        if (untilNextFrame > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(untilNextFrame));
+    }
+}
+
+void PhysicManager::sendCommand(SimulationCommand command) {
+    if (!commands.push(command))
+        std::cerr << "Simulation command queue is full, command dropped" << std::endl;
+}
+
+void PhysicManager::processCommands() {
+
+    SimulationCommand command;
+    while (commands.pop(command)) {
+        switch (command) {
+            case SimulationCommand::TogglePause:
+                unPause();
+                break;
+        }
+    }
+}
+
+void PhysicManager::publishRenderState() {
+
+    //The current state lags behind the wall clock by the time that is still accumulated
+    RenderState &state = renderStates.back();
+    state.current = x;
+    state.time = std::chrono::steady_clock::now() -
+                 std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(lag));
+    renderStates.publish();
+}
+
+void PhysicManager::syncRenderState() {
+
+    renderStates.update();
+    const RenderState &state = renderStates.front();
+
+    float alpha = 1.0f;
+    if (interpolateRenderState) {
+        std::chrono::duration<double> sinceState = std::chrono::steady_clock::now() - state.time;
+        alpha = (float) std::clamp(sinceState.count() / frameTime, 0.0, 1.0);
+    }
+    renderPositions = state.previous + alpha * (state.current - state.previous);
+
+    for (auto &sim: simObjs) {
+        sim->updateObjectState(renderPositions);
+    }
+}
+
+void PhysicManager::update(double elapsedTime) {
+
+    processCommands();
+
+    if (paused) {
+        lag = 0.0;
+        return;
+    }
+
+    lag += elapsedTime;
+
+    int frames = 0;
+    while (lag >= frameTime && frames < maxCatchUpFrames) {
+        lag -= frameTime;
+        fixedUpdate();
+        frames++;
+    }
+
+    //If we are still behind, the simulation cannot keep up with real time. Drop the
+    //whole frames we are missing instead of trying to catch up (spiral of death).
+    if (lag >= frameTime) {
+        double remainder = std::fmod(lag, frameTime);
+        droppedTime += lag - remainder;
+        lag = remainder;
+    }
+}
+
+int PhysicManager::getNumSubsteps() const {
+    //The small tolerance avoids an extra substep when frameTime is a multiple of timeStep
+    return std::max(1, (int) std::ceil(frameTime / timeStep - 1e-4));
 }
 
 void PhysicManager::fixedUpdate() {
 
     if (paused) return;
 
+    //The substeps cover exactly one frame, so simulated time advances with real time
+    int substeps = getNumSubsteps();
+    auto h = (float) (frameTime / substeps);
+    if (h != substepSize) {
+        substepSize = h;
+        for (auto& simObj: simObjs)
+            simObj->setTimeStep(h);
+    }
+
+    //In debug builds this asserts that the whole step runs without heap allocations. Eigen's own
+    //check is global, so it is skipped when the render thread runs alongside this one.
+    NoAllocationScope noAllocations(!isThreaded());
+
+    //The state before the frame is kept for render interpolation
+    renderStates.back().previous = x;
+
+    if (adaptiveTimeStep) {
+        for (int i = 0; i < substeps; i++)
+            stepSelfIntegrated(h);
+        stepAdaptive(frameTime);
+    } else {
+        for (int i = 0; i < substeps; i++)
+            step(h);
+    }
+
+    //Only the state after the last substep is published to the renderer
+    publishRenderState();
+//    paused = true;
+}
+
+void PhysicManager::step(float h) {
+
+    stepSelfIntegrated(h);
+    stepSolver(h);
+    solveSolverCollisions(h);
+    solveObjectCollisions(h);
+}
+
+void PhysicManager::stepSelfIntegrated(float h) {
+
+    for (Simulable* sim: selfIntegratedSims) {
+        sim->step(h);
+        sim->solveCollisions(h);
+    }
+}
+
+void PhysicManager::solveObjectCollisions(float h) {
+
+    int numSims = (int) broadphaseSims.size();
+    if (numSims < 2)
+        return;
+
+    threadPool.parallelFor(numSims, [&](int s) {
+        float* box = &simBounds[6 * s];
+        int numNodes = broadphaseSims[s]->getNumDoFs() / 3;
+        if (numNodes == 0) {
+            std::fill(box, box + 6, 0.0f);
+            return;
+        }
+        Eigen::Map<const Eigen::Matrix3Xf> nodes(x.data() + simStart[s], 3, numNodes);
+        Eigen::Vector3f::Map(box) = nodes.rowwise().minCoeff();
+        Eigen::Vector3f::Map(box + 3) = nodes.rowwise().maxCoeff();
+    });
+    broadphase.update(simBounds);
+
+    const std::vector<int>& pairs = broadphase.getPairs();
+    for (std::size_t p = 0; p < pairs.size(); p += 2) {
+        Simulable* a = broadphaseSims[pairs[p]];
+        Simulable* b = broadphaseSims[pairs[p + 1]];
+        a->solveObjectCollisions(*b, h);
+        b->solveObjectCollisions(*a, h);
+    }
+}
+
+void PhysicManager::stepSolver(float h) {
+
+    if (numSolverDoFs == 0)
+        return;
+
     switch (integrationMethod) {
         case Integration::Symplectic:
-            stepSymplectic();
+            stepSymplectic(h);
             break;
         case Integration::Explicit:
-            std::cout << "Explicit method not implemented." << std::endl;
+            stepExplicit(h);
+            break;
+        case Integration::VelocityVerlet:
+            stepVelocityVerlet(h);
+            break;
+        case Integration::RK4:
+            stepRK4(h);
             break;
         case Integration::Implicit:
-            std::cout << "Implicit method not implemented." << std::endl;
+            stepImplicit(h);
+            break;
+        case Integration::ImplicitMatrixFree:
+            stepImplicitMatrixFree(h);
+            break;
+        case Integration::IMEX:
+            stepIMEX(h);
             break;
         default:
             std::cerr << "INTEGRATION METHOD NOT SPECIFIED!" << std::endl;
             break;
     }
+}
 
-    for (auto &sim: simObjs) {
-        sim->updateObjectState();
+void PhysicManager::solveSolverCollisions(float h) {
+
+    for (Simulable* sim: solverSims)
+        sim->solveCollisions(h);
+}
+
+void PhysicManager::stepAdaptive(double duration) {
+
+    lastFrameSteps = 0;
+    if (numSolverDoFs == 0)
+        return;
+
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    float upperBound = std::min(maxTimeStep, stableTimeStep);
+    double t = 0.0;
+    while (t < duration) {
+        auto remaining = (float) (duration - t);
+        bool truncated = nextTimeStep >= remaining;
+        float h = truncated ? remaining : nextTimeStep;
+        //Stretch the step instead of leaving a sliver shorter than the minimum at the end of the frame
+        if (!truncated && remaining - h < minTimeStep) {
+            h = remaining;
+            truncated = true;
+        }
+
+        //Step doubling: one full step, then two half steps from the same snapshot. Collisions are left
+        //out of the trial steps, so contacts do not show up as error and the BVH is not refit for a
+        //state that may be discarded.
+        savedX = xs;
+        savedV = vs;
+        stepSolver(h);
+        singleStepX = xs;
+        xs = savedX;
+        vs = savedV;
+        verletAccelValid = false;
+        stepSolver(0.5f * h);
+        stepSolver(0.5f * h);
+
+        //The local error of a method of order p grows as h^(p + 1)
+        float error = (xs - singleStepX).lpNorm<Eigen::Infinity>();
+        float scale = error > 0.0f ? 0.9f * std::pow(adaptiveTolerance / error, 1.0f / (float) (integrationOrder() + 1)) : 2.0f;
+        if (error > adaptiveTolerance && h > minTimeStep) {
+            xs = savedX;
+            vs = savedV;
+            verletAccelValid = false;
+            rejectedSteps++;
+            nextTimeStep = std::max(minTimeStep, h * std::max(0.2f, scale));
+            continue;
+        }
+
+        //The more accurate half step result is kept
+        //A step up to the end of the frame lands on it exactly, without float round off slivers
+        t = truncated ? duration : t + h;
+        lastTimeStep = h;
+        lastFrameSteps++;
+        solveSolverCollisions(h);
+        solveObjectCollisions(h);
+        //A step cut short by the end of the frame says nothing about how far the next one can go
+        if (!truncated || scale < 1.0f)
+            nextTimeStep = std::min(std::max(h * std::min(2.0f, scale), minTimeStep), upperBound);
     }
-//    paused = true;
 }
 
-void PhysicManager::stepSymplectic() {
-    VectorXR x(numDoFs);
-    VectorXR v(numDoFs);
-    VectorXR f(numDoFs);
+int PhysicManager::integrationOrder() const {
+    switch (integrationMethod) {
+        case Integration::VelocityVerlet:
+            return 2;
+        case Integration::RK4:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+void PhysicManager::evaluateForces() {
     f.setZero();
-    MatrixXR massInv(numDoFs, numDoFs);
-    massInv.setZero();
+    for (Simulable* sim: solverSims)
+        sim->getFore(f);
+}
 
-    for (auto &sim: simObjs) {
-        sim->getPosition(x);
-        sim->getVelocity(v);
+void PhysicManager::stepExplicit(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    evaluateForces();
+
+    //Forward Euler: both updates use the state at the start of the step
+    xs += h * vs;
+    vs += h * massInv.cwiseProduct(f);
+
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+}
+
+void PhysicManager::stepSymplectic(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    evaluateForces();
+
+    vs += h * massInv.cwiseProduct(f);
+    xs += h * vs;
+
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+}
+
+void PhysicManager::stepVelocityVerlet(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+
+    //The acceleration at the end of a step is the one at the start of the next, so the forces are
+    //evaluated once per step, as in symplectic Euler
+    if (!verletAccelValid) {
+        evaluateForces();
+        verletAccel = massInv.cwiseProduct(f);
+    }
+
+    vs += (0.5f * h) * verletAccel;
+    xs += h * vs;
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+
+    //Velocity dependent forces (damping) see the half step velocity
+    evaluateForces();
+    verletAccel = massInv.cwiseProduct(f);
+    vs += (0.5f * h) * verletAccel;
+    verletAccelValid = true;
+}
+
+void PhysicManager::stepRK4(float h) {
+    stageX0 = x.head(numSolverDoFs);
+    stageV0 = v.head(numSolverDoFs);
+    stageSumX.setZero();
+    stageSumV.setZero();
+
+    //Classic RK4 on the state (x, v): stage weights 1, 2, 2, 1, and the next stage is evaluated
+    //at h/2, h/2 and h from the start state
+    const float weights[4] = {1.0f, 2.0f, 2.0f, 1.0f};
+    const float steps[4] = {0.5f * h, 0.5f * h, h, h / 6.0f};
+    for (int stage = 0; stage < 4; stage++) {
+        evaluateForces();
+        bool last = stage == 3;
+        if (batchExplicitStages) {
+            int chunks = (numSolverDoFs + StateGrain - 1) / StateGrain;
+            threadPool.parallelFor(chunks, [&](int chunk) {
+                int begin = chunk * StateGrain;
+                applyRK4Stage(begin, std::min(StateGrain, numSolverDoFs - begin), weights[stage], steps[stage], last);
+            });
+        } else {
+            applyRK4Stage(0, numSolverDoFs, weights[stage], steps[stage], last);
+        }
+        for (Simulable* sim: solverSims)
+            sim->updateState();
+    }
+}
+
+void PhysicManager::applyRK4Stage(int begin, int count, float weight, float step, bool last) {
+    auto xs = x.segment(begin, count);
+    auto vs = v.segment(begin, count);
+    auto sumX = stageSumX.segment(begin, count);
+    auto sumV = stageSumV.segment(begin, count);
+    auto accel = massInv.segment(begin, count).cwiseProduct(f.segment(begin, count));
+
+    //The stage derivative of the positions is the stage velocity, so it is read before vs is moved
+    sumX += weight * vs;
+    sumV += weight * accel;
+    if (last) {
+        xs = stageX0.segment(begin, count) + step * sumX;
+        vs = stageV0.segment(begin, count) + step * sumV;
+    } else {
+        xs = stageX0.segment(begin, count) + step * vs;
+        vs = stageV0.segment(begin, count) + step * accel;
+    }
+}
+
+void PhysicManager::stepImplicit(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    f.setZero();
+    dFdx.coeffs().setZero();
+    dFdv.coeffs().setZero();
+
+    for (Simulable* sim: solverSims) {
         sim->getFore(f);
-        sim->getMassInverse(massInv);
+        sim->getForceJacobian(dFdx, dFdv);
     }
 
-    v += timeStep * (massInv * f);
-    x += timeStep * v;
+    //Linearized backward Euler:
+    //(M - h * dFdv - h^2 * dFdx) * v' = (M - h * dFdv) * v + h * f
+    tmp.noalias() = dFdv * vs;
+    b = mass.cwiseProduct(vs) + h * f - h * tmp;
+    A.coeffs() = -h * dFdv.coeffs() - h * h * dFdx.coeffs();
+    A.diagonal() += mass;
+    applyFixedDoFs(A, b);
+    solveSystem(vs);
 
-    for (auto &sim: simObjs) {
-        sim->setPosition(x);
-        sim->setVelocity(v);
+    xs += h * vs;
+
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+}
+
+void PhysicManager::stepImplicitMatrixFree(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    f.setZero();
+    tmp.setZero();
+
+    //Same system as stepImplicit(), but the jacobians only appear in products
+    for (Simulable* sim: solverSims) {
+        sim->getFore(f);
+        sim->applyForceJacobian(vs, tmp, 0.0f);
+    }
+    b = mass.cwiseProduct(vs) + h * f - h * tmp;
+    for (int dof: fixedDoFs)
+        b[dof] = 0.0f;
+
+    cg.tolerance = solverTolerance;
+    cg.maxIterations = solverMaxIterations;
+    implicitOperator.set(solverSims, mass, fixedDoFs, h);
+    massPreconditioner.set(massInv);
+    cg.solve(implicitOperator, massPreconditioner, b, vs);
+    lastSolverIterations = cg.iterations();
+    lastSolverError = cg.error();
+
+    xs += h * vs;
+
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+}
+
+void PhysicManager::solveDirect(Eigen::Ref<VectorXR> solution) {
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        //Eigen's numeric factorization uses temporaries, and vectorD() returns a copy
+        AllocationAllowedScope allocations;
+        directSolver.factorize(A);
+        if (directSolver.info() == Eigen::Success)
+            directDiagonalInv = directSolver.vectorD().cwiseInverse();
+    }
+    auto factorized = std::chrono::steady_clock::now();
+    if (directSolver.info() != Eigen::Success) {
+        std::cout << "Implicit system could not be factorized." << std::endl;
+        return;
+    }
+    //The factors are applied by hand because solve() permutes the result in place, which allocates
+    directWork = directSolver.permutationP() * b;
+    directSolver.matrixL().solveInPlace(directWork);
+    directWork.array() *= directDiagonalInv.array();
+    directSolver.matrixU().solveInPlace(directWork);
+    solution = directSolver.permutationPinv() * directWork;
+    auto solved = std::chrono::steady_clock::now();
+
+    lastFactorizeTime = std::chrono::duration<float, std::milli>(factorized - start).count();
+    lastSolveTime = std::chrono::duration<float, std::milli>(solved - factorized).count();
+    lastSolverIterations = 0;
+    lastSolverError = 0.0f;
+}
+
+void PhysicManager::stepIMEX(float h) {
+    auto xs = x.head(numSolverDoFs);
+    auto vs = v.head(numSolverDoFs);
+    f.setZero();
+    dFdx.coeffs().setZero();
+
+    for (Simulable* sim: solverSims) {
+        sim->getFore(f);
+        sim->getStiffForceJacobian(dFdx);
+    }
+
+    //All the forces are evaluated explicitly, and the stiff ones are linearized at the end of
+    //the step: (M - h^2 * dFdx_stiff) * v' = M * v + h * f
+    b = mass.cwiseProduct(vs) + h * f;
+    A.coeffs() = -h * h * dFdx.coeffs();
+    A.diagonal() += mass;
+    applyFixedDoFs(A, b);
+    solveSystem(vs);
+
+    xs += h * vs;
+
+    for (Simulable* sim: solverSims)
+        sim->updateState();
+}
+
+void PhysicManager::solveSystem(Eigen::Ref<VectorXR> solution) {
+
+    if (linearSolver == LinearSolver::DirectLDLT) {
+        solveDirect(solution);
+        return;
     }
+
+    //The previous velocity is a good initial guess
+    cg.tolerance = solverTolerance;
+    cg.maxIterations = solverMaxIterations;
+    blockA.setValues(A);
+    solveIterative(activePreconditioner, solution);
+}
+
+template<typename Preconditioner>
+void PhysicManager::runCG(const Preconditioner &precond, Eigen::Ref<VectorXR> solution) {
+
+    if (blockSystemMatrix)
+        cg.solve(blockA, precond, b, solution);
+    else
+        cg.solve(A, precond, b, solution);
+    lastSolverIterations = cg.iterations();
+    lastSolverError = cg.error();
+}
+
+void PhysicManager::solveIterative(PreconditionerType type, Eigen::Ref<VectorXR> solution) {
+
+    auto start = std::chrono::steady_clock::now();
+    auto setupTime = [&]() {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    switch (type) {
+        case PreconditionerType::BlockJacobiPrecond:
+            blockJacobi.compute(blockA);
+            lastPreconditionerTime = setupTime();
+            runCG(blockJacobi, solution);
+            break;
+        case PreconditionerType::GaussSeidelPrecond:
+            gaussSeidel.compute(blockA);
+            lastPreconditionerTime = setupTime();
+            runCG(gaussSeidel, solution);
+            break;
+        case PreconditionerType::MultigridPrecond:
+            multigrid.compute(A);
+            lastPreconditionerTime = setupTime();
+            runCG(multigrid, solution);
+            break;
+        case PreconditionerType::IncompleteCholeskyPrecond: {
+            //Eigen's incomplete factorization and its triangular solves use temporaries at every
+            //step, so this is the one preconditioner that gives up the allocation-free step
+            AllocationAllowedScope allocations;
+            incompleteCholesky.compute(A);
+            lastPreconditionerTime = setupTime();
+            runCG(incompleteCholesky, solution);
+            break;
+        }
+        default:
+            preconditioner.compute(A);
+            lastPreconditionerTime = setupTime();
+            runCG(preconditioner, solution);
+            break;
+    }
+}
+
+PreconditionerType PhysicManager::selectPreconditioner() const {
+
+    //Fixed DoFs are identity rows that CG never updates, so only the free ones count. Small
+    //systems converge in a few iterations and the cheapest preconditioner that captures the
+    //coupling within a node wins. The iterations of the single level preconditioners grow with
+    //the resolution of the mesh, while the V-cycle keeps them nearly constant.
+    int freeNodes = (numSolverDoFs - (int) fixedDoFs.size()) / 3;
+    if (freeNodes <= AutoPrecondSmallNodes)
+        return PreconditionerType::BlockJacobiPrecond;
+    if (multigrid.numLevels() > 1)
+        return PreconditionerType::MultigridPrecond;
+    return PreconditionerType::GaussSeidelPrecond;
+}
+
+void PhysicManager::applyFixedDoFs(SparseMatrixR &matrix, VectorXR &rhs) {
+
+    //Replace the rows and columns of the fixed DoFs by the identity so their velocity is zero
+    for (int dof: fixedDoFs) {
+        for (SparseMatrixR::InnerIterator it(matrix, dof); it; ++it) {
+            int row = (int) it.row();
+            it.valueRef() = row == dof ? 1.0f : 0.0f;
+            if (row != dof)
+                matrix.coeffRef(dof, row) = 0.0f;
+        }
+        rhs[dof] = 0.0f;
+    }
+}
+
+void PhysicManager::setNumThreads(int numThreads) {
+    threadPool.resize(std::max(1, numThreads));
 }
 
 void PhysicManager::unPause() {
@@ -0,0 +1,58 @@
+#include <preconditioners.h>
+
+BlockJacobiPreconditioner &BlockJacobiPreconditioner::compute(const BlockSparseMatrix &m) {
+
+    numBlocks = m.numBlockRows();
+    inverseBlocks.resize(9 * numBlocks);
+    for (int i = 0; i < numBlocks; i++) {
+        //Blocks are sorted by column, so the diagonal one is the first of an upper block row
+        int k = m.rowOffsets[i];
+        while (m.blockCols[k] != i)
+            k++;
+        Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> block(&m.values[9 * k]);
+        Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> inverse(&inverseBlocks[9 * i]);
+        inverse = block.inverse();
+    }
+    return *this;
+}
+
+GaussSeidelPreconditioner &GaussSeidelPreconditioner::compute(const BlockSparseMatrix &m) {
+
+    matrix = &m;
+    diagonal.compute(m);
+    remainder.resize(m.rows());
+    return *this;
+}
+
+void GaussSeidelPreconditioner::sweep(const Eigen::Ref<const VectorXR> &b, Eigen::Ref<VectorXR> x) const {
+
+    const BlockSparseMatrix &m = *matrix;
+    int n = m.numBlockRows();
+
+    //Forward: solve (D + L) y = b. Once y_i is known, the lower blocks of column i are applied
+    //to the following rows.
+    remainder = b;
+    for (int i = 0; i < n; i++) {
+        x.segment<3>(3 * i).noalias() = diagonal.inverseBlock(i) * remainder.segment<3>(3 * i);
+        for (int k = m.rowOffsets[i]; k < m.rowOffsets[i + 1]; k++) {
+            int j = m.blockCols[k];
+            if (j == i)
+                continue;
+            Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> block(&m.values[9 * k]);
+            remainder.segment<3>(3 * j).noalias() -= block.transpose() * x.segment<3>(3 * i);
+        }
+    }
+
+    //Backward: solve (D + U) z = D y in place, the rows below i already hold z
+    for (int i = n - 1; i >= 0; i--) {
+        Eigen::Vector3f upper = Eigen::Vector3f::Zero();
+        for (int k = m.rowOffsets[i]; k < m.rowOffsets[i + 1]; k++) {
+            int j = m.blockCols[k];
+            if (j == i)
+                continue;
+            Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> block(&m.values[9 * k]);
+            upper.noalias() += block * x.segment<3>(3 * j);
+        }
+        x.segment<3>(3 * i).noalias() -= diagonal.inverseBlock(i) * upper;
+    }
+}
@@ -0,0 +1,207 @@
+#include <projectiveDynamicsCloth.h>
+#include <algorithm>
+#include <iostream>
+
+ProjectiveDynamicsCloth::ProjectiveDynamicsCloth(float mass, float stiffnessStretch, float stiffnessBend,
+                                                 float dampingAlpha, int iterations, PhysicManager &manager,
+                                                 Object &object)
+        : mass(mass), stiffnessStretch(stiffnessStretch), stiffnessBend(stiffnessBend), dampingAlpha(dampingAlpha),
+          iterations(iterations), manager(manager), object(object) {}
+
+void ProjectiveDynamicsCloth::initialize(int idx) {
+
+    index = idx;
+    numNodes = (int) object.positions.size() / 3;
+    constraints.clear();
+    constraints.addMeshEdges(object.positions, object.triangles);
+    constraints.sortByColor(numNodes);
+    constraints.setParameters(SpringType::Stretch, stiffnessStretch, 0.0f);
+    constraints.setParameters(SpringType::Bend, stiffnessBend, 0.0f);
+    std::cout << "Constraint colors: " << constraints.numColors() << std::endl;
+
+    float nodeMassValue = mass / (float) numNodes;
+    nodeMass.setConstant(numNodes, nodeMassValue);
+    nodeMassInv.setConstant(numNodes, 1.0f / nodeMassValue);
+    if (index == 0)
+        nodeMassInv[0] = 0.0f;
+
+    inertia.setZero(numNodes, 3);
+    rhs.setZero(numNodes, 3);
+    permuted.setZero(numNodes, 3);
+    solution.setZero(numNodes, 3);
+    fixedCoupling.setZero(numNodes, 3);
+    prevPos.setZero(getNumDoFs());
+    accelerator.resize(getNumDoFs());
+
+    //The mesh changed, so the pattern has to be analyzed again on the next factorization
+    factoredStep = 0.0f;
+}
+
+int ProjectiveDynamicsCloth::getNumDoFs() {
+    return 3 * numNodes;
+}
+
+void ProjectiveDynamicsCloth::bindState(VectorXR& x, VectorXR& v) {
+
+    new (&pos) Eigen::Map<VectorXR>(x.data() + index, getNumDoFs());
+    new (&vel) Eigen::Map<VectorXR>(v.data() + index, getNumDoFs());
+    pos = object.positions;
+    vel.setZero();
+}
+
+void ProjectiveDynamicsCloth::buildSystem(float h) {
+
+    std::vector<TripletR> triplets;
+    fixedCoupling.setZero();
+    float invH2 = 1.0f / (h * h);
+    for (int i = 0; i < numNodes; i++)
+        triplets.emplace_back(i, i, nodeMassInv[i] > 0.0f ? nodeMass[i] * invH2 : 1.0f);
+
+    //Each constraint adds w to both diagonals and -w to the coupling terms. The couplings with a
+    //fixed node move to the right hand side, so fixed rows stay an identity.
+    for (int s = 0; s < constraints.size(); s++) {
+        int nodeA = constraints.a[s] / 3;
+        int nodeB = constraints.b[s] / 3;
+        float w = constraints.stiffness[s];
+        bool freeA = nodeMassInv[nodeA] > 0.0f;
+        bool freeB = nodeMassInv[nodeB] > 0.0f;
+        if (freeA)
+            triplets.emplace_back(nodeA, nodeA, w);
+        if (freeB)
+            triplets.emplace_back(nodeB, nodeB, w);
+        if (freeA && freeB) {
+            triplets.emplace_back(nodeA, nodeB, -w);
+            triplets.emplace_back(nodeB, nodeA, -w);
+        } else if (freeA) {
+            fixedCoupling.row(nodeA) += w * pos.segment<3>(3 * nodeB).transpose();
+        } else if (freeB) {
+            fixedCoupling.row(nodeB) += w * pos.segment<3>(3 * nodeA).transpose();
+        }
+    }
+
+    system.resize(numNodes, numNodes);
+    system.setFromTriplets(triplets.begin(), triplets.end());
+}
+
+void ProjectiveDynamicsCloth::setTimeStep(float h) {
+
+    if (h == factoredStep)
+        return;
+
+    buildSystem(h);
+    //The pattern only depends on the mesh, so the ordering and symbolic analysis are done once
+    if (factoredStep == 0.0f)
+        solver.analyzePattern(system);
+    solver.factorize(system);
+    if (solver.info() != Eigen::Success)
+        std::cout << "Projective dynamics: the global matrix could not be factored" << std::endl;
+    diagonalInv = solver.vectorD().cwiseInverse();
+    factoredStep = h;
+}
+
+void ProjectiveDynamicsCloth::step(float h) {
+
+    //Only reached when the cloth is stepped outside of PhysicManager::fixedUpdate()
+    if (h != factoredStep)
+        setTimeStep(h);
+
+    ThreadPool& pool = manager.threadPool;
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+
+    //Inertial prediction, which is also the initial guess of the iterations
+    float damping = 1.0f / (1.0f + h * dampingAlpha);
+    float invH2 = 1.0f / (h * h);
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = chunk * NodeGrain;
+        int count = std::min(NodeGrain, numNodes - begin);
+        Eigen::Map<Eigen::Matrix3Xf> p(pos.data() + 3 * begin, 3, count);
+        Eigen::Map<Eigen::Matrix3Xf> v(vel.data() + 3 * begin, 3, count);
+        Eigen::Map<Eigen::Matrix3Xf> prev(prevPos.data() + 3 * begin, 3, count);
+        prev = p;
+        for (int i = 0; i < count; i++) {
+            if (nodeMassInv[begin + i] > 0.0f)
+                v.col(i) = damping * (v.col(i) + h * manager.gravity);
+            else
+                v.col(i).setZero();
+        }
+        p += h * v;
+        for (int i = 0; i < count; i++) {
+            float scale = nodeMassInv[begin + i] > 0.0f ? nodeMass[begin + i] * invH2 : 1.0f;
+            inertia.row(begin + i) = scale * p.col(i).transpose();
+        }
+    });
+
+    accelerator.begin(pos);
+    for (int it = 0; it < iterations; it++) {
+
+        //Local step: project every constraint to its rest length and add w * A^T p to the right
+        //hand side. Constraints of a color never share a node, so their chunks run concurrently.
+        pool.parallelFor(nodeChunks, [&](int chunk) {
+            int begin = chunk * NodeGrain;
+            int count = std::min(NodeGrain, numNodes - begin);
+            rhs.middleRows(begin, count) = inertia.middleRows(begin, count) + fixedCoupling.middleRows(begin, count);
+        });
+        for (int c = 0; c < constraints.numColors(); c++) {
+            int colorBegin = constraints.colorOffsets[c];
+            int colorEnd = constraints.colorOffsets[c + 1];
+            int chunks = (colorEnd - colorBegin + SpringGrain - 1) / SpringGrain;
+            pool.parallelFor(chunks, [&](int chunk) {
+                int begin = colorBegin + chunk * SpringGrain;
+                int end = std::min(colorEnd, begin + SpringGrain);
+                for (int s = begin; s < end; s++) {
+                    int nodeA = constraints.a[s] / 3;
+                    int nodeB = constraints.b[s] / 3;
+                    Vector3R d = pos.segment<3>(constraints.a[s]) - pos.segment<3>(constraints.b[s]);
+                    Vector3R projection = (constraints.stiffness[s] * constraints.length0[s] / d.norm()) * d;
+                    if (nodeMassInv[nodeA] > 0.0f)
+                        rhs.row(nodeA) += projection.transpose();
+                    if (nodeMassInv[nodeB] > 0.0f)
+                        rhs.row(nodeB) -= projection.transpose();
+                }
+            });
+        }
+
+        //Global step: the coordinates are independent, one back substitution each. The factors
+        //are applied by hand because solve() permutes the result in place, which allocates.
+        pool.parallelFor(3, [&](int c) {
+            auto column = permuted.col(c);
+            column = solver.permutationP() * rhs.col(c);
+            solver.matrixL().solveInPlace(column);
+            column.array() *= diagonalInv.array();
+            solver.matrixU().solveInPlace(column);
+            solution.col(c) = solver.permutationPinv() * column;
+        });
+
+        pool.parallelFor(nodeChunks, [&](int chunk) {
+            int begin = chunk * NodeGrain;
+            int count = std::min(NodeGrain, numNodes - begin);
+            Eigen::Map<Eigen::Matrix3Xf>(pos.data() + 3 * begin, 3, count) =
+                    solution.middleRows(begin, count).transpose();
+        });
+        accelerator.apply(pos);
+    }
+
+    float invH = 1.0f / h;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = 3 * chunk * NodeGrain;
+        int count = 3 * std::min(NodeGrain, numNodes - chunk * NodeGrain);
+        vel.segment(begin, count) = invH * (pos.segment(begin, count) - prevPos.segment(begin, count));
+    });
+}
+
+void ProjectiveDynamicsCloth::updateState() {
+}
+
+void ProjectiveDynamicsCloth::getMass(VectorXR& m) {
+
+    Eigen::Map<Eigen::Matrix3Xf>(m.data() + index, 3, numNodes).rowwise() = nodeMass.transpose();
+}
+
+void ProjectiveDynamicsCloth::getMassInverse(VectorXR& massInv) {
+
+    Eigen::Map<Eigen::Matrix3Xf>(massInv.data() + index, 3, numNodes).rowwise() = nodeMassInv.transpose();
+}
+
+void ProjectiveDynamicsCloth::updateObjectState(const VectorXR& positions) {
+    object.positions = positions.segment(index, getNumDoFs());
+}
@@ -0,0 +1,289 @@
+#include <sdfObstacle.h>
+#include <bvh.h>
+#include <collisionUtils.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+//Cloth nodes per task of the contact pass, smaller than the grain of the cloth passes as every node
+//samples the grid
+constexpr int ContactGrain = 256;
+//Sweep rounds over the 8 orderings, stopped early once no value changes
+constexpr int MaxSweepRounds = 4;
+//First bytes of a cache file
+constexpr std::uint32_t CacheMagic = 0x31464453u;
+
+SDFObstacle::SDFObstacle(const Object& object) : positions(object.positions), triangles(object.triangles) {}
+
+void SDFObstacle::initialize(ThreadPool& pool) {
+
+    //Grid over the mesh bounds, with room for the band and one more cell on every side
+    Eigen::Map<const Eigen::Matrix<float, 3, Eigen::Dynamic>> points(positions.data(), 3, positions.size() / 3);
+    Eigen::Vector3f lo = points.rowwise().minCoeff();
+    Eigen::Vector3f hi = points.rowwise().maxCoeff();
+    Eigen::Vector3f extent = hi - lo;
+    cellSize = std::max(extent.maxCoeff() / (float) resolution, 1e-6f);
+    int padding = narrowBand + 1;
+    origin = lo.array() - (float) padding * cellSize;
+    for (int a = 0; a < 3; a++)
+        dims[a] = (int) std::ceil(extent[a] / cellSize) + 2 * padding + 1;
+
+    std::uint64_t key = hash();
+    cached = !cachePath.empty() && loadCache(key);
+    if (cached)
+        return;
+
+    bakeBand(pool);
+    taskChanged.assign(dims[0], 0);
+    for (int round = 0; round < MaxSweepRounds; round++) {
+        bool changed = false;
+        for (int ordering = 0; ordering < 8; ordering++)
+            changed |= sweep(ordering & 1 ? -1 : 1, ordering & 2 ? -1 : 1, ordering & 4 ? -1 : 1, pool);
+        if (!changed)
+            break;
+    }
+    std::vector<char>().swap(frozen);
+    std::vector<char>().swap(taskChanged);
+
+    if (!cachePath.empty())
+        saveCache(key);
+}
+
+void SDFObstacle::bakeBand(ThreadPool& pool) {
+
+    TriangleBVH bvh;
+    bvh.build(positions, triangles, pool);
+    const std::vector<int>& tris = bvh.getTriangles();
+    int numTriangles = (int) tris.size() / 3;
+    std::vector<float> normals(3 * numTriangles);
+    for (int t = 0; t < numTriangles; t++) {
+        Eigen::Map<const Eigen::Vector3f> a(&positions[3 * tris[3 * t]]);
+        Eigen::Map<const Eigen::Vector3f> b(&positions[3 * tris[3 * t + 1]]);
+        Eigen::Map<const Eigen::Vector3f> c(&positions[3 * tris[3 * t + 2]]);
+        Eigen::Vector3f::Map(&normals[3 * t]) = (b - a).cross(c - a).normalized();
+    }
+
+    //Exact distance to the closest triangle within the band, one z slice per task. The points outside
+    //it start at infinity and are filled by the sweeps.
+    phi.assign((std::size_t) dims[0] * dims[1] * dims[2], std::numeric_limits<float>::infinity());
+    frozen.assign(phi.size(), 0);
+    float band = (float) narrowBand * cellSize;
+    pool.parallelFor(dims[2], [&](int k) {
+        for (int j = 0; j < dims[1]; j++) {
+            for (int i = 0; i < dims[0]; i++) {
+                Eigen::Vector3f p = origin + cellSize * Eigen::Vector3f((float) i, (float) j, (float) k);
+                float closestDistance = band * band;
+                float closestAlignment = 0.0f;
+                int closestTriangle = -1;
+                Eigen::Vector3f closestOffset;
+                bvh.queryBox(p.array() - band, p.array() + band, [&](int t) {
+                    Eigen::Vector3f q = closestPointOnTriangle(p, positions.segment<3>(3 * tris[3 * t]),
+                                                               positions.segment<3>(3 * tris[3 * t + 1]),
+                                                               positions.segment<3>(3 * tris[3 * t + 2]));
+                    Eigen::Vector3f offset = p - q;
+                    float distance = offset.squaredNorm();
+                    //The triangles sharing a closest edge or vertex are equally close. The one facing p the
+                    //most gives the right side, the others may not at sharp edges.
+                    float alignment = std::abs(offset.dot(Eigen::Vector3f::Map(&normals[3 * t])));
+                    if (distance > closestDistance * (1.0f + 1e-5f))
+                        return;
+                    if (distance >= closestDistance * (1.0f - 1e-5f) && alignment <= closestAlignment)
+                        return;
+                    closestDistance = std::min(distance, closestDistance);
+                    closestAlignment = alignment;
+                    closestTriangle = t;
+                    closestOffset = offset;
+                });
+                if (closestTriangle < 0)
+                    continue;
+                float distance = std::sqrt(closestDistance);
+                bool inside = closestOffset.dot(Eigen::Vector3f::Map(&normals[3 * closestTriangle])) < 0.0f;
+                phi[index(i, j, k)] = inside ? -distance : distance;
+                frozen[index(i, j, k)] = 1;
+            }
+        }
+    });
+}
+
+bool SDFObstacle::sweep(int sx, int sy, int sz, ThreadPool& pool) {
+
+    //A point only depends on its neighbours in the previous plane i + j + k = const along the ordering,
+    //so the points of a plane are updated in parallel, one row of i per task
+    std::fill(taskChanged.begin(), taskChanged.end(), 0);
+    int planes = dims[0] + dims[1] + dims[2] - 2;
+    for (int plane = 0; plane < planes; plane++) {
+        int firstRow = std::max(0, plane - (dims[1] - 1) - (dims[2] - 1));
+        int lastRow = std::min(dims[0] - 1, plane);
+        pool.parallelFor(lastRow - firstRow + 1, [&](int task) {
+            int si = firstRow + task;
+            int i = sx > 0 ? si : dims[0] - 1 - si;
+            int firstColumn = std::max(0, plane - si - (dims[2] - 1));
+            int lastColumn = std::min(dims[1] - 1, plane - si);
+            for (int sj = firstColumn; sj <= lastColumn; sj++) {
+                int j = sy > 0 ? sj : dims[1] - 1 - sj;
+                int sk = plane - si - sj;
+                int k = sz > 0 ? sk : dims[2] - 1 - sk;
+                if (frozen[index(i, j, k)])
+                    continue;
+                float& value = phi[index(i, j, k)];
+
+                //Smallest neighbour distance along each axis, and the sign of the closest neighbour
+                int coords[3] = {i, j, k};
+                int strides[3] = {1, dims[0], dims[0] * dims[1]};
+                float a[3];
+                float closest = std::numeric_limits<float>::infinity();
+                float sign = 1.0f;
+                for (int axis = 0; axis < 3; axis++) {
+                    a[axis] = std::numeric_limits<float>::infinity();
+                    for (int side = -1; side <= 1; side += 2) {
+                        int c = coords[axis] + side;
+                        if (c < 0 || c >= dims[axis])
+                            continue;
+                        float neighbour = phi[index(i, j, k) + side * strides[axis]];
+                        a[axis] = std::min(a[axis], std::abs(neighbour));
+                        if (std::abs(neighbour) < closest) {
+                            closest = std::abs(neighbour);
+                            sign = neighbour < 0.0f ? -1.0f : 1.0f;
+                        }
+                    }
+                }
+                if (closest == std::numeric_limits<float>::infinity())
+                    continue;
+
+                //Solution of the discrete Eikonal equation |grad phi| = 1 using the axes whose neighbours
+                //are close enough (Zhao, A fast sweeping method for eikonal equations)
+                std::sort(a, a + 3);
+                float d = a[0] + cellSize;
+                if (d > a[1]) {
+                    d = 0.5f * (a[0] + a[1] + std::sqrt(2.0f * cellSize * cellSize - (a[0] - a[1]) * (a[0] - a[1])));
+                    if (d > a[2]) {
+                        float sum = a[0] + a[1] + a[2];
+                        float squares = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+                        d = (sum + std::sqrt(std::max(0.0f, sum * sum - 3.0f * (squares - cellSize * cellSize)))) / 3.0f;
+                    }
+                }
+                if (d < std::abs(value)) {
+                    value = sign * d;
+                    taskChanged[si] = 1;
+                }
+            }
+        });
+    }
+    return std::find(taskChanged.begin(), taskChanged.end(), 1) != taskChanged.end();
+}
+
+bool SDFObstacle::sample(const Eigen::Vector3f& p, float& distance, Eigen::Vector3f& gradient) const {
+
+    Eigen::Vector3f g = (p - origin) / cellSize;
+    int cell[3];
+    float f[3];
+    for (int a = 0; a < 3; a++) {
+        if (!(g[a] >= 0.0f && g[a] <= (float) (dims[a] - 1)))
+            return false;
+        cell[a] = std::min((int) g[a], dims[a] - 2);
+        f[a] = g[a] - (float) cell[a];
+    }
+
+    //Corner values c[x + 2 * y + 4 * z], interpolated along x, then y, then z
+    float c[8];
+    for (int corner = 0; corner < 8; corner++)
+        c[corner] = phi[index(cell[0] + (corner & 1), cell[1] + (corner >> 1 & 1), cell[2] + (corner >> 2))];
+    float x00 = c[0] + f[0] * (c[1] - c[0]);
+    float x10 = c[2] + f[0] * (c[3] - c[2]);
+    float x01 = c[4] + f[0] * (c[5] - c[4]);
+    float x11 = c[6] + f[0] * (c[7] - c[6]);
+    float y0 = x00 + f[1] * (x10 - x00);
+    float y1 = x01 + f[1] * (x11 - x01);
+    distance = y0 + f[2] * (y1 - y0);
+
+    float dx00 = c[1] - c[0];
+    float dx10 = c[3] - c[2];
+    float dx01 = c[5] - c[4];
+    float dx11 = c[7] - c[6];
+    float dx0 = dx00 + f[1] * (dx10 - dx00);
+    float dx1 = dx01 + f[1] * (dx11 - dx01);
+    gradient[0] = (dx0 + f[2] * (dx1 - dx0)) / cellSize;
+    gradient[1] = ((x10 - x00) + f[2] * ((x11 - x01) - (x10 - x00))) / cellSize;
+    gradient[2] = (y1 - y0) / cellSize;
+    return true;
+}
+
+void SDFObstacle::resolveContacts(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                                  float thickness, float h, ThreadPool& pool) const {
+
+    //The field holds the distance to the surface wherever the node ended, so a node that went deep into
+    //the obstacle during the step is still pushed out on the nearest side
+    static_cast<void>(h);
+    int numNodes = (int) nodeMassInv.size();
+    int chunks = (numNodes + ContactGrain - 1) / ContactGrain;
+    pool.parallelFor(chunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * ContactGrain);
+        for (int i = chunk * ContactGrain; i < end; i++) {
+            if (nodeMassInv[i] == 0.0f)
+                continue;
+            Eigen::Vector3f p = pos.segment<3>(3 * i);
+            float distance;
+            Eigen::Vector3f gradient;
+            if (!sample(p, distance, gradient) || distance >= thickness)
+                continue;
+            float gradientNorm = gradient.norm();
+            if (gradientNorm < 1e-6f)
+                continue;
+            Eigen::Vector3f n = gradient / gradientNorm;
+            pos.segment<3>(3 * i) = p + (thickness - distance) * n;
+            vel.segment<3>(3 * i) = contactVelocity(vel.segment<3>(3 * i), n, friction);
+        }
+    });
+}
+
+std::uint64_t SDFObstacle::hash() const {
+
+    //FNV-1a over the mesh and the settings that shape the grid. The counts go first, so meshes whose
+    //arrays split the same bytes differently do not collide.
+    std::uint64_t value = 0xcbf29ce484222325ull;
+    auto add = [&](const void* data, std::size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t b = 0; b < size; b++) {
+            value ^= bytes[b];
+            value *= 0x100000001b3ull;
+        }
+    };
+    std::uint64_t counts[2] = {(std::uint64_t) positions.size(), (std::uint64_t) triangles.size()};
+    add(counts, sizeof(counts));
+    add(positions.data(), positions.size() * sizeof(*positions.data()));
+    add(triangles.data(), triangles.size() * sizeof(*triangles.data()));
+    add(&resolution, sizeof(resolution));
+    add(&narrowBand, sizeof(narrowBand));
+    return value;
+}
+
+bool SDFObstacle::loadCache(std::uint64_t key) {
+
+    std::ifstream file(cachePath, std::ios::binary);
+    if (!file)
+        return false;
+    std::uint32_t magic = 0;
+    std::uint64_t fileKey = 0;
+    int fileDims[3] = {0, 0, 0};
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char*>(&fileKey), sizeof(fileKey));
+    file.read(reinterpret_cast<char*>(fileDims), sizeof(fileDims));
+    if (!file || magic != CacheMagic || fileKey != key || !std::equal(fileDims, fileDims + 3, dims))
+        return false;
+    phi.resize((std::size_t) dims[0] * dims[1] * dims[2]);
+    file.read(reinterpret_cast<char*>(phi.data()), (std::streamsize) (phi.size() * sizeof(float)));
+    return (bool) file;
+}
+
+void SDFObstacle::saveCache(std::uint64_t key) const {
+
+    std::ofstream file(cachePath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&CacheMagic), sizeof(CacheMagic));
+    file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+    file.write(reinterpret_cast<const char*>(phi.data()), (std::streamsize) (phi.size() * sizeof(float)));
+    if (!file)
+        std::cout << "Could not write the distance field cache " << cachePath << std::endl;
+}
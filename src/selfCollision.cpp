@@ -0,0 +1,499 @@
+#include <selfCollision.h>
+#include <collisionUtils.h>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+static inline int cellCoord(float p, float invCell) {
+    return (int) std::floor(p * invCell);
+}
+
+static inline int hashCell(int x, int y, int z, int mask) {
+    return (int) (((unsigned) x * 73856093u) ^ ((unsigned) y * 19349663u) ^ ((unsigned) z * 83492791u)) & mask;
+}
+
+void SelfCollision::initialize(const VectorXR& positions, const Vectori& tris) {
+
+    numNodes = (int) positions.size() / 3;
+    numTriangles = (int) tris.size() / 3;
+    triangles.assign(tris.data(), tris.data() + tris.size());
+
+    //Unique mesh edges, sorted so their order does not depend on hashing
+    std::vector<std::pair<int, int>> edgeList;
+    edgeList.reserve(triangles.size());
+    for (int t = 0; t < numTriangles; t++) {
+        for (int j = 0; j < 3; j++) {
+            int a = triangles[3 * t + j];
+            int b = triangles[3 * t + (j + 1) % 3];
+            edgeList.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    std::sort(edgeList.begin(), edgeList.end());
+    edgeList.erase(std::unique(edgeList.begin(), edgeList.end()), edgeList.end());
+
+    numEdges = (int) edgeList.size();
+    edges.resize(2 * numEdges);
+    float totalLength = 0.0f;
+    for (int e = 0; e < numEdges; e++) {
+        edges[2 * e] = edgeList[e].first;
+        edges[2 * e + 1] = edgeList[e].second;
+        totalLength += (positions.segment<3>(3 * edgeList[e].first) - positions.segment<3>(3 * edgeList[e].second)).norm();
+    }
+
+    //Cells of about one edge keep the number of items per cell and of cells per query small
+    float meanEdge = numEdges > 0 ? totalLength / (float) numEdges : 1.0f;
+    cellSize = meanEdge;
+    thickness = thicknessScale * meanEdge;
+
+    int tableSize = 1;
+    while (tableSize < 2 * std::max(numNodes, numEdges))
+        tableSize *= 2;
+    tableMask = tableSize - 1;
+
+    vertexCells.resize(3 * numNodes);
+    vertexKeys.resize(numNodes);
+    vertexStart.resize(tableSize + 1);
+    vertexSorted.resize(numNodes);
+    vertexSortedCells.resize(3 * numNodes);
+    edgeBounds.resize(6 * numEdges);
+    edgeEntryStart.resize(numEdges + 1);
+    edgeStart.resize(tableSize + 1);
+
+    //Every buffer of the step is sized here from the mesh, so solve() never allocates
+    int maxEntries = cellsPerEdge * numEdges;
+    edgeEntries.resize(maxEntries);
+    edgeCells.resize(3 * maxEntries);
+    edgeKeys.resize(maxEntries);
+    edgeSorted.resize(maxEntries);
+    edgeSortedItems.resize(maxEntries);
+    edgeSortedCells.resize(3 * maxEntries);
+
+    int triangleChunks = (numTriangles + PrimitiveGrain - 1) / PrimitiveGrain;
+    int edgeChunks = (numEdges + PrimitiveGrain - 1) / PrimitiveGrain;
+    int room = candidatesPerPrimitive * PrimitiveGrain;
+    triangleChunkPairs.assign(triangleChunks, std::vector<int>(2 * room));
+    edgeChunkPairs.assign(edgeChunks, std::vector<int>(2 * room));
+    triangleChunkCounts.assign(triangleChunks, 0);
+    edgeChunkCounts.assign(edgeChunks, 0);
+
+    int maxVertexTriangle = triangleChunks * room;
+    int maxEdgeEdge = edgeChunks * room;
+    int maxCandidates = maxVertexTriangle + maxEdgeEdge;
+    candidateNodes.resize(4 * maxCandidates);
+    candidateWeights.resize(4 * maxCandidates);
+    candidateNormals.resize(3 * maxCandidates);
+    candidateImpulses.resize(maxCandidates);
+    nodeEntries.resize(4 * maxCandidates);
+    chunkContacts.resize((maxVertexTriangle + CandidateGrain - 1) / CandidateGrain +
+                         (maxEdgeEdge + CandidateGrain - 1) / CandidateGrain);
+
+    nodeStart.resize(numNodes + 1);
+    numVertexTriangle = 0;
+    numCandidates = 0;
+    lastCandidates = 0;
+    lastContacts = 0;
+    lastDroppedCandidates = 0;
+    lastDroppedCells = 0;
+}
+
+void SelfCollision::solve(Eigen::Ref<VectorXR> pos, Eigen::Ref<VectorXR> vel, const VectorXR& nodeMassInv,
+                          float h, ThreadPool& pool) {
+
+    if (numTriangles == 0)
+        return;
+
+    buildHash(pos.data(), pool);
+    findCandidates(pos.data(), pool);
+    gatherCandidates();
+
+    for (int i = 0; i < iterations; i++) {
+        computeImpulses(pos.data(), vel.data(), nodeMassInv.data(), h, pool);
+        if (lastContacts == 0)
+            break;
+        applyImpulses(pos.data(), vel.data(), nodeMassInv.data(), h, pool);
+    }
+}
+
+void SelfCollision::buildHash(const float* pos, ThreadPool& pool) {
+
+    float invCell = 1.0f / cellSize;
+
+    //Vertices, by the cell of their position
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int i = chunk * NodeGrain; i < end; i++) {
+            int* cell = &vertexCells[3 * i];
+            for (int k = 0; k < 3; k++)
+                cell[k] = cellCoord(pos[3 * i + k], invCell);
+            vertexKeys[i] = hashCell(cell[0], cell[1], cell[2], tableMask);
+        }
+    });
+    countingSort(vertexKeys.data(), numNodes, vertexStart, vertexSorted.data());
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int s = chunk * NodeGrain; s < end; s++)
+            for (int k = 0; k < 3; k++)
+                vertexSortedCells[3 * s + k] = vertexCells[3 * vertexSorted[s] + k];
+    });
+
+    //Edges, in every cell their grown bounds overlap. The entries are counted first, so each task
+    //knows where to write its own.
+    int edgeChunks = (numEdges + PrimitiveGrain - 1) / PrimitiveGrain;
+    float margin = 0.5f * thickness;
+    pool.parallelFor(edgeChunks, [&](int chunk) {
+        int end = std::min(numEdges, (chunk + 1) * PrimitiveGrain);
+        for (int e = chunk * PrimitiveGrain; e < end; e++) {
+            Eigen::Map<const Eigen::Vector3f> a(pos + 3 * edges[2 * e]);
+            Eigen::Map<const Eigen::Vector3f> b(pos + 3 * edges[2 * e + 1]);
+            Eigen::Map<Eigen::Vector3f> lo(&edgeBounds[6 * e]);
+            Eigen::Map<Eigen::Vector3f> hi(&edgeBounds[6 * e + 3]);
+            lo = a.cwiseMin(b).array() - margin;
+            hi = a.cwiseMax(b).array() + margin;
+            int cells = 1;
+            for (int k = 0; k < 3; k++)
+                cells *= cellCoord(hi[k], invCell) - cellCoord(lo[k], invCell) + 1;
+            edgeEntryStart[e + 1] = cells;
+        }
+    });
+    //The entries past the room of the table are dropped, from the last edges
+    int capacity = (int) edgeEntries.size();
+    long long totalEntries = 0;
+    edgeEntryStart[0] = 0;
+    for (int e = 0; e < numEdges; e++) {
+        totalEntries += edgeEntryStart[e + 1];
+        edgeEntryStart[e + 1] = (int) std::min<long long>(capacity, totalEntries);
+    }
+    int numEntries = edgeEntryStart[numEdges];
+    lastDroppedCells = (int) (totalEntries - numEntries);
+
+    pool.parallelFor(edgeChunks, [&](int chunk) {
+        int end = std::min(numEdges, (chunk + 1) * PrimitiveGrain);
+        for (int e = chunk * PrimitiveGrain; e < end; e++) {
+            const float* lo = &edgeBounds[6 * e];
+            const float* hi = &edgeBounds[6 * e + 3];
+            int x0 = cellCoord(lo[0], invCell);
+            int y0 = cellCoord(lo[1], invCell);
+            int z0 = cellCoord(lo[2], invCell);
+            int ny = cellCoord(hi[1], invCell) - y0 + 1;
+            int nz = cellCoord(hi[2], invCell) - z0 + 1;
+            //Cells in x, y, z order, up to the entries the edge got
+            for (int entry = edgeEntryStart[e]; entry < edgeEntryStart[e + 1]; entry++) {
+                int k = entry - edgeEntryStart[e];
+                int x = x0 + k / (ny * nz);
+                int y = y0 + k / nz % ny;
+                int z = z0 + k % nz;
+                edgeEntries[entry] = e;
+                edgeCells[3 * entry] = x;
+                edgeCells[3 * entry + 1] = y;
+                edgeCells[3 * entry + 2] = z;
+                edgeKeys[entry] = hashCell(x, y, z, tableMask);
+            }
+        }
+    });
+    countingSort(edgeKeys.data(), numEntries, edgeStart, edgeSorted.data());
+    int entryChunks = (numEntries + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(entryChunks, [&](int chunk) {
+        int end = std::min(numEntries, (chunk + 1) * NodeGrain);
+        for (int s = chunk * NodeGrain; s < end; s++) {
+            int entry = edgeSorted[s];
+            edgeSortedItems[s] = edgeEntries[entry];
+            for (int k = 0; k < 3; k++)
+                edgeSortedCells[3 * s + k] = edgeCells[3 * entry + k];
+        }
+    });
+}
+
+void SelfCollision::findCandidates(const float* pos, ThreadPool& pool) {
+
+    float invCell = 1.0f / cellSize;
+
+    //Vertex-triangle: the vertices in the cells of the triangle bounds, grown by the thickness
+    pool.parallelFor((int) triangleChunkPairs.size(), [&](int chunk) {
+        std::vector<int>& pairs = triangleChunkPairs[chunk];
+        int room = (int) pairs.size() / 2;
+        int found = 0;
+        int end = std::min(numTriangles, (chunk + 1) * PrimitiveGrain);
+        for (int t = chunk * PrimitiveGrain; t < end; t++) {
+            int a = triangles[3 * t];
+            int b = triangles[3 * t + 1];
+            int c = triangles[3 * t + 2];
+            Eigen::Map<const Eigen::Vector3f> pa(pos + 3 * a), pb(pos + 3 * b), pc(pos + 3 * c);
+            Eigen::Vector3f lo = pa.cwiseMin(pb).cwiseMin(pc).array() - thickness;
+            Eigen::Vector3f hi = pa.cwiseMax(pb).cwiseMax(pc).array() + thickness;
+            int x0 = cellCoord(lo[0], invCell), x1 = cellCoord(hi[0], invCell);
+            int y0 = cellCoord(lo[1], invCell), y1 = cellCoord(hi[1], invCell);
+            int z0 = cellCoord(lo[2], invCell), z1 = cellCoord(hi[2], invCell);
+            for (int x = x0; x <= x1; x++)
+                for (int y = y0; y <= y1; y++)
+                    for (int z = z0; z <= z1; z++) {
+                        int key = hashCell(x, y, z, tableMask);
+                        for (int s = vertexStart[key]; s < vertexStart[key + 1]; s++) {
+                            int v = vertexSorted[s];
+                            const int* cell = &vertexSortedCells[3 * s];
+                            //Skip other cells hashed to the same bucket, and the triangle's own vertices
+                            if (cell[0] != x || cell[1] != y || cell[2] != z || v == a || v == b || v == c)
+                                continue;
+                            Eigen::Map<const Eigen::Vector3f> p(pos + 3 * v);
+                            if ((p.array() < lo.array()).any() || (p.array() > hi.array()).any())
+                                continue;
+                            if (found < room) {
+                                pairs[2 * found] = v;
+                                pairs[2 * found + 1] = t;
+                            }
+                            found++;
+                        }
+                    }
+        }
+        triangleChunkCounts[chunk] = found;
+    });
+
+    //Edge-edge: two edges closer than the thickness have overlapping grown bounds, so they share
+    //a cell. A pair is only kept by the edge with the lower index, in the cell holding the lower
+    //corner of the overlap, so that it is found once.
+    pool.parallelFor((int) edgeChunkPairs.size(), [&](int chunk) {
+        std::vector<int>& pairs = edgeChunkPairs[chunk];
+        int room = (int) pairs.size() / 2;
+        int found = 0;
+        int end = std::min(numEdges, (chunk + 1) * PrimitiveGrain);
+        for (int e = chunk * PrimitiveGrain; e < end; e++) {
+            int a = edges[2 * e];
+            int b = edges[2 * e + 1];
+            Eigen::Map<const Eigen::Array3f> lo(&edgeBounds[6 * e]);
+            Eigen::Map<const Eigen::Array3f> hi(&edgeBounds[6 * e + 3]);
+            for (int entry = edgeEntryStart[e]; entry < edgeEntryStart[e + 1]; entry++) {
+                const int* cell = &edgeCells[3 * entry];
+                int key = edgeKeys[entry];
+                //The counting sort keeps the entries of a bucket in edge order, so the scan can stop
+                //at the first edge with a lower index
+                for (int s = edgeStart[key + 1] - 1; s >= edgeStart[key]; s--) {
+                    int other = edgeSortedItems[s];
+                    if (other <= e)
+                        break;
+                    const int* otherCell = &edgeSortedCells[3 * s];
+                    if (otherCell[0] != cell[0] || otherCell[1] != cell[1] || otherCell[2] != cell[2])
+                        continue;
+                    int c = edges[2 * other];
+                    int d = edges[2 * other + 1];
+                    //Edges sharing a node are always in contact
+                    if (c == a || c == b || d == a || d == b)
+                        continue;
+                    Eigen::Map<const Eigen::Array3f> otherLo(&edgeBounds[6 * other]);
+                    Eigen::Map<const Eigen::Array3f> otherHi(&edgeBounds[6 * other + 3]);
+                    if ((otherHi < lo).any() || (otherLo > hi).any())
+                        continue;
+                    Eigen::Array3f corner = lo.max(otherLo);
+                    if (cellCoord(corner[0], invCell) != cell[0] || cellCoord(corner[1], invCell) != cell[1] ||
+                        cellCoord(corner[2], invCell) != cell[2])
+                        continue;
+                    if (found < room) {
+                        pairs[2 * found] = e;
+                        pairs[2 * found + 1] = other;
+                    }
+                    found++;
+                }
+            }
+        }
+        edgeChunkCounts[chunk] = found;
+    });
+
+    //The pairs a task found past its room were not stored
+    lastDroppedCandidates = 0;
+    for (std::size_t chunk = 0; chunk < triangleChunkPairs.size(); chunk++) {
+        int room = (int) triangleChunkPairs[chunk].size() / 2;
+        lastDroppedCandidates += std::max(0, triangleChunkCounts[chunk] - room);
+        triangleChunkCounts[chunk] = std::min(triangleChunkCounts[chunk], room);
+    }
+    for (std::size_t chunk = 0; chunk < edgeChunkPairs.size(); chunk++) {
+        int room = (int) edgeChunkPairs[chunk].size() / 2;
+        lastDroppedCandidates += std::max(0, edgeChunkCounts[chunk] - room);
+        edgeChunkCounts[chunk] = std::min(edgeChunkCounts[chunk], room);
+    }
+}
+
+void SelfCollision::gatherCandidates() {
+
+    numVertexTriangle = 0;
+    for (int count: triangleChunkCounts)
+        numVertexTriangle += count;
+    numCandidates = numVertexTriangle;
+    for (int count: edgeChunkCounts)
+        numCandidates += count;
+    lastCandidates = numCandidates;
+
+    int* nodes = candidateNodes.data();
+    for (std::size_t chunk = 0; chunk < triangleChunkPairs.size(); chunk++) {
+        const std::vector<int>& pairs = triangleChunkPairs[chunk];
+        for (int k = 0; k < triangleChunkCounts[chunk]; k++) {
+            int t = pairs[2 * k + 1];
+            nodes[0] = pairs[2 * k];
+            nodes[1] = triangles[3 * t];
+            nodes[2] = triangles[3 * t + 1];
+            nodes[3] = triangles[3 * t + 2];
+            nodes += 4;
+        }
+    }
+    for (std::size_t chunk = 0; chunk < edgeChunkPairs.size(); chunk++) {
+        const std::vector<int>& pairs = edgeChunkPairs[chunk];
+        for (int k = 0; k < edgeChunkCounts[chunk]; k++) {
+            nodes[0] = edges[2 * pairs[2 * k]];
+            nodes[1] = edges[2 * pairs[2 * k] + 1];
+            nodes[2] = edges[2 * pairs[2 * k + 1]];
+            nodes[3] = edges[2 * pairs[2 * k + 1] + 1];
+            nodes += 4;
+        }
+    }
+
+    //Candidate slots by node. The candidates stay the same for all the response passes of the step.
+    countingSort(candidateNodes.data(), 4 * numCandidates, nodeStart, nodeEntries.data());
+}
+
+void SelfCollision::computeImpulses(const float* pos, const float* vel, const float* massInv, float h,
+                                    ThreadPool& pool) {
+
+    int vertexTriangleChunks = (numVertexTriangle + CandidateGrain - 1) / CandidateGrain;
+    int edgeEdgeChunks = (numCandidates - numVertexTriangle + CandidateGrain - 1) / CandidateGrain;
+    pool.parallelFor(vertexTriangleChunks + edgeEdgeChunks, [&](int chunk) {
+        bool vertexTriangle = chunk < vertexTriangleChunks;
+        int begin = vertexTriangle ? chunk * CandidateGrain
+                                   : numVertexTriangle + (chunk - vertexTriangleChunks) * CandidateGrain;
+        int end = std::min(vertexTriangle ? numVertexTriangle : numCandidates, begin + CandidateGrain);
+        for (int first = begin; first < end; first += Batch) {
+            int count = std::min(Batch, end - first);
+            if (vertexTriangle)
+                vertexTriangleBatch(first, count, pos, vel, massInv, h);
+            else
+                edgeEdgeBatch(first, count, pos, vel, massInv, h);
+        }
+        int contacts = 0;
+        for (int c = begin; c < end; c++)
+            contacts += candidateImpulses[c] > 0.0f;
+        chunkContacts[chunk] = contacts;
+    });
+
+    lastContacts = 0;
+    for (int chunk = 0; chunk < vertexTriangleChunks + edgeEdgeChunks; chunk++)
+        lastContacts += chunkContacts[chunk];
+}
+
+//Impulse that brings the relative normal velocity of a contact up to the one that removes the given
+//fraction of the thickness violation in the next step. Zero for lanes that are not in contact.
+static BatchArray contactImpulse(const CandidateBatch& batch, const BatchArray* weights, const BatchVectors& normal,
+                                 const BatchArray& gap, const BatchMask& inContact,
+                                 float thickness, float repulsion, float h) {
+
+    BatchVectors relativeVelocity = BatchVectors::Zero();
+    BatchArray effectiveMassInv = BatchArray::Zero();
+    for (int k = 0; k < 4; k++) {
+        for (int j = 0; j < 3; j++)
+            relativeVelocity.col(j) += weights[k] * batch.v[k].col(j);
+        effectiveMassInv += weights[k] * weights[k] * batch.massInv[k];
+    }
+    BatchArray normalVelocity = dot(relativeVelocity, normal);
+    BatchArray target = (repulsion / h) * (thickness - gap);
+    BatchArray impulse = (target - normalVelocity).max(0.0f) / effectiveMassInv.max(1e-20f);
+    return (inContact && effectiveMassInv > 0.0f).select(impulse, 0.0f);
+}
+
+void SelfCollision::vertexTriangleBatch(int begin, int count, const float* pos, const float* vel,
+                                        const float* massInv, float h) {
+
+    CandidateBatch batch(&candidateNodes[4 * begin], count, pos, vel, massInv);
+    const BatchVectors* x = batch.x;
+
+    //Distance to the triangle plane, and barycentric coordinates of the projection
+    BatchVectors e0 = x[2] - x[1];
+    BatchVectors e1 = x[3] - x[1];
+    BatchVectors r = x[0] - x[1];
+    BatchVectors normal = cross(e0, e1);
+    BatchArray normalLength = dot(normal, normal).sqrt().max(1e-20f);
+    for (int j = 0; j < 3; j++)
+        normal.col(j) /= normalLength;
+    BatchArray distance = dot(r, normal);
+    BatchArray wa, wb, wc;
+    triangleBarycentric(x[0], x[1], x[2], x[3], wa, wb, wc);
+
+    //The normal points from the triangle to the vertex
+    BatchArray side = (distance < 0.0f).select(BatchArray::Constant(-1.0f), BatchArray::Constant(1.0f));
+    for (int j = 0; j < 3; j++)
+        normal.col(j) *= side;
+    BatchArray gap = distance.abs();
+    BatchMask inContact = gap < thickness && wa >= 0.0f && wb >= 0.0f && wc >= 0.0f;
+
+    BatchArray weights[4] = {BatchArray::Ones(), -wa, -wb, -wc};
+    BatchArray impulse = contactImpulse(batch, weights, normal, gap, inContact, thickness, repulsion, h);
+
+    for (int lane = 0; lane < count; lane++) {
+        int c = begin + lane;
+        for (int k = 0; k < 4; k++)
+            candidateWeights[4 * c + k] = weights[k][lane];
+        for (int j = 0; j < 3; j++)
+            candidateNormals[3 * c + j] = normal(lane, j);
+        candidateImpulses[c] = impulse[lane];
+    }
+}
+
+void SelfCollision::edgeEdgeBatch(int begin, int count, const float* pos, const float* vel,
+                                  const float* massInv, float h) {
+
+    CandidateBatch batch(&candidateNodes[4 * begin], count, pos, vel, massInv);
+    const BatchVectors* x = batch.x;
+
+    //Closest points x0 + s * d1 and x2 + t * d2 of the two segments
+    BatchVectors d1 = x[1] - x[0];
+    BatchVectors d2 = x[3] - x[2];
+    BatchVectors r = x[0] - x[2];
+    BatchArray s, t;
+    segmentClosestPoints(x[0], x[1], x[2], x[3], s, t);
+
+    //The normal points from the second edge to the first
+    BatchVectors normal;
+    for (int j = 0; j < 3; j++)
+        normal.col(j) = r.col(j) + s * d1.col(j) - t * d2.col(j);
+    BatchArray gap = dot(normal, normal).sqrt();
+    for (int j = 0; j < 3; j++)
+        normal.col(j) /= gap.max(1e-20f);
+    //Crossing edges have no separating direction, and are left to the vertex-triangle contacts
+    BatchMask inContact = gap < thickness && gap > 1e-6f * thickness;
+
+    BatchArray weights[4] = {1.0f - s, s, t - 1.0f, -t};
+    BatchArray impulse = contactImpulse(batch, weights, normal, gap, inContact, thickness, repulsion, h);
+
+    for (int lane = 0; lane < count; lane++) {
+        int candidate = begin + lane;
+        for (int k = 0; k < 4; k++)
+            candidateWeights[4 * candidate + k] = weights[k][lane];
+        for (int j = 0; j < 3; j++)
+            candidateNormals[3 * candidate + j] = normal(lane, j);
+        candidateImpulses[candidate] = impulse[lane];
+    }
+}
+
+void SelfCollision::applyImpulses(float* pos, float* vel, const float* massInv, float h, ThreadPool& pool) {
+
+    //Each node gathers the impulses of its contacts, so the nodes can be updated in parallel
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int end = std::min(numNodes, (chunk + 1) * NodeGrain);
+        for (int i = chunk * NodeGrain; i < end; i++) {
+            if (massInv[i] == 0.0f)
+                continue;
+            Eigen::Vector3f dv = Eigen::Vector3f::Zero();
+            int active = 0;
+            for (int s = nodeStart[i]; s < nodeStart[i + 1]; s++) {
+                int slot = nodeEntries[s];
+                int c = slot / 4;
+                if (candidateImpulses[c] == 0.0f)
+                    continue;
+                dv += candidateWeights[slot] * candidateImpulses[c] * Eigen::Map<const Eigen::Vector3f>(&candidateNormals[3 * c]);
+                active++;
+            }
+            if (active == 0)
+                continue;
+            //The contacts of a node are averaged (Jacobi), so that they do not push it several times over
+            dv *= massInv[i] / (float) active;
+            Eigen::Map<Eigen::Vector3f>(vel + 3 * i) += dv;
+            Eigen::Map<Eigen::Vector3f>(pos + 3 * i) += h * dv;
+        }
+    });
+}
@@ -1,41 +1,322 @@
 #include <spring.h>
+#include <structs.h>
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
 
-Spring::Spring(Node &nodeA, Node &nodeB, SpringType springType, PhysicManager &manager) : nodeA(nodeA), nodeB(nodeB),
-                                                                                          springType(springType),
-                                                                                          manager(manager) {
-    direction = (nodeA.pos - nodeB.pos);
-    length = direction.norm();
-    length0 = length;
-    direction.normalize();
+using Packet = Eigen::internal::packet_traits<float>::type;
+constexpr int PacketSize = Eigen::internal::packet_traits<float>::size;
+
+void SpringSet::clear() {
+    a.clear();
+    b.clear();
+    length0.clear();
+    stiffness.clear();
+    damping.clear();
+    springType.clear();
+    colorOffsets.clear();
+}
+
+void SpringSet::add(int nodeA, int nodeB, SpringType type, const Eigen::Ref<const VectorXR>& pos) {
+    a.push_back(nodeA);
+    b.push_back(nodeB);
+    length0.push_back((pos.segment<3>(nodeA) - pos.segment<3>(nodeB)).norm());
+    stiffness.push_back(0.0f);
+    damping.push_back(0.0f);
+    springType.push_back(type);
 }
-void Spring::initialize(float stiff, float damp) {
-    stiffness = stiff;
-    damping = damp;
+
+void SpringSet::addMeshEdges(const VectorXR& positions, const Vectori& triangles) {
+
+    //Read the mesh edges to create the cloth springs.
+    std::unordered_set<Edge, Edge> edgeSet;
+    int bCount = 0;
+    for (int i = 0; i < triangles.size(); i += 3) {
+        for (int j = 0; j < 3; j++) {
+            int vA = i + j;
+            int vB = i + ((j + 1) % 3);
+            int vO = i + ((j + 2) % 3);
+
+            Edge edge = {(int)triangles[vA], (int)triangles[vB], (int)triangles[vO]};
+            auto it = edgeSet.insert(edge);
+            if (!it.second) {
+                bCount++;
+                //If the edge already exist we should create a bend spring
+                add(3 * edge.o, 3 * it.first->o, SpringType::Bend, positions);
+            }
+        }
+    }
+    std::cout << "Stretch springs: " << edgeSet.size() << " Bend Springs: " << bCount << std::endl;
+    //Once all the edges have been created we just have to create the stretch springs
+    for (auto &it: edgeSet) {
+        add(3 * it.a, 3 * it.b, SpringType::Stretch, positions);
+    }
 }
 
-void Spring::updateState() {
-    direction = nodeA.pos - nodeB.pos;
-    length = direction.norm(); //norm() return the magnitude fo the vector
-    direction.normalize();
+void SpringSet::setParameters(SpringType type, float stiff, float damp) {
+    for (int s = 0; s < size(); s++) {
+        if (springType[s] == type) {
+            stiffness[s] = stiff;
+            damping[s] = damp;
+        }
+    }
+}
+
+void SpringSet::sortByColor(int numNodes) {
+
+    //Greedy coloring of the springs: a spring takes the first color none of its nodes uses yet.
+    std::vector<std::vector<int>> nodeColors(numNodes);
+    std::vector<int> color(size());
+    int colors = 0;
+    for (int s = 0; s < size(); s++) {
+        const std::vector<int>& colorsA = nodeColors[a[s] / 3];
+        const std::vector<int>& colorsB = nodeColors[b[s] / 3];
+        int c = 0;
+        while (std::find(colorsA.begin(), colorsA.end(), c) != colorsA.end() ||
+               std::find(colorsB.begin(), colorsB.end(), c) != colorsB.end())
+            c++;
+        color[s] = c;
+        nodeColors[a[s] / 3].push_back(c);
+        nodeColors[b[s] / 3].push_back(c);
+        colors = std::max(colors, c + 1);
+    }
+
+    std::vector<int> order(size());
+    for (int s = 0; s < size(); s++)
+        order[s] = s;
+    std::stable_sort(order.begin(), order.end(), [&](int s0, int s1) { return color[s0] < color[s1]; });
+
+    SpringSet sorted;
+    for (int s: order) {
+        sorted.a.push_back(a[s]);
+        sorted.b.push_back(b[s]);
+        sorted.length0.push_back(length0[s]);
+        sorted.stiffness.push_back(stiffness[s]);
+        sorted.damping.push_back(damping[s]);
+        sorted.springType.push_back(springType[s]);
+    }
+    sorted.colorOffsets.assign(colors + 1, 0);
+    for (int s = 0; s < size(); s++)
+        sorted.colorOffsets[color[s] + 1]++;
+    for (int c = 0; c < colors; c++)
+        sorted.colorOffsets[c + 1] += sorted.colorOffsets[c];
+
+    *this = std::move(sorted);
 }
 
-void Spring::getForces(VectorXR& force) {
+void SpringSet::getForces(int begin, int end, const float* pos, const float* vel, float* force) const {
+    using namespace Eigen::internal;
+
+    //Node data is gathered into packet sized buffers, the spring forces are computed
+    //PacketSize springs at a time, and then scattered back in spring order.
+    EIGEN_ALIGN_MAX float dx[3][PacketSize];
+    EIGEN_ALIGN_MAX float dv[3][PacketSize];
+    EIGEN_ALIGN_MAX float fs[3][PacketSize];
+
+    int s = begin;
+    for (; s + PacketSize <= end; s += PacketSize) {
+        for (int k = 0; k < PacketSize; k++) {
+            const float* pA = pos + a[s + k];
+            const float* pB = pos + b[s + k];
+            const float* vA = vel + a[s + k];
+            const float* vB = vel + b[s + k];
+            for (int c = 0; c < 3; c++) {
+                dx[c][k] = pA[c] - pB[c];
+                dv[c][k] = vA[c] - vB[c];
+            }
+        }
+
+        Packet x = pload<Packet>(dx[0]);
+        Packet y = pload<Packet>(dx[1]);
+        Packet z = pload<Packet>(dx[2]);
+        Packet len = psqrt(padd(padd(pmul(x, x), pmul(y, y)), pmul(z, z)));
+        Packet invLen = pdiv(pset1<Packet>(1.0f), len);
+        x = pmul(x, invLen);
+        y = pmul(y, invLen);
+        z = pmul(z, invLen);
+
+        //Damping only acts on the relative velocity along the spring
+        Packet relVel = padd(padd(pmul(x, pload<Packet>(dv[0])), pmul(y, pload<Packet>(dv[1]))),
+                             pmul(z, pload<Packet>(dv[2])));
+        Packet stretch = pmul(ploadu<Packet>(&stiffness[s]), psub(len, ploadu<Packet>(&length0[s])));
+        Packet magnitude = pnegate(padd(stretch, pmul(ploadu<Packet>(&damping[s]), relVel)));
+
+        pstore(fs[0], pmul(magnitude, x));
+        pstore(fs[1], pmul(magnitude, y));
+        pstore(fs[2], pmul(magnitude, z));
 
-    static_cast<void>(force);
-    Vector3R dirN = direction.normalized();
-    Vector3R dampForce = -damping * dirN * dirN.dot(nodeA.pos - nodeB.pos);
-    Vector3R totalForce = -stiffness * (length - length0) * dirN + dampForce;
+        for (int k = 0; k < PacketSize; k++) {
+            for (int c = 0; c < 3; c++) {
+                force[a[s + k] + c] += fs[c][k];
+                force[b[s + k] + c] -= fs[c][k];
+            }
+        }
+    }
 
-    force.segment<3>(nodeA.index) += totalForce;
-    force.segment<3>(nodeB.index) -= totalForce;
+    //Remaining springs, with the same operations as the packet path
+    for (; s < end; s++) {
+        Vector3R d = Eigen::Map<const Vector3R>(pos + a[s]) - Eigen::Map<const Vector3R>(pos + b[s]);
+        Vector3R relV = Eigen::Map<const Vector3R>(vel + a[s]) - Eigen::Map<const Vector3R>(vel + b[s]);
+        float len = std::sqrt(d.x() * d.x() + d.y() * d.y() + d.z() * d.z());
+        Vector3R u = d * (1.0f / len);
+        float relVel = u.x() * relV.x() + u.y() * relV.y() + u.z() * relV.z();
+        float magnitude = -(stiffness[s] * (len - length0[s]) + damping[s] * relVel);
 
+        Eigen::Map<Vector3R>(force + a[s]) += magnitude * u;
+        Eigen::Map<Vector3R>(force + b[s]) -= magnitude * u;
+    }
 }
 
-void Spring::getForceJacobians(MatrixXR& dFdx, MatrixXR& dFdv) {
+void SpringSet::getForceJacobianPattern(int offset, std::vector<TripletR>& pattern) const {
 
-    static_cast<void>(dFdx);
-    static_cast<void>(dFdv);
+    getForceJacobianPattern(offset, SpringType::Stretch, pattern);
+    getForceJacobianPattern(offset, SpringType::Bend, pattern);
+}
+
+void SpringSet::getForceJacobianPattern(int offset, SpringType type, std::vector<TripletR>& pattern) const {
 
+    for (int s = 0; s < size(); s++) {
+        if (springType[s] != type)
+            continue;
+        int iA = offset + a[s];
+        int iB = offset + b[s];
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                pattern.emplace_back(iA + i, iA + j, 0.0f);
+                pattern.emplace_back(iA + i, iB + j, 0.0f);
+                pattern.emplace_back(iB + i, iA + j, 0.0f);
+                pattern.emplace_back(iB + i, iB + j, 0.0f);
+            }
+        }
+    }
 }
 
+void SpringSet::getForceJacobians(int offset, const float* pos, SparseMatrixR& dFdx, SparseMatrixR& dFdv) const {
+
+    for (int s = 0; s < size(); s++) {
+        int iA = offset + a[s];
+        int iB = offset + b[s];
+        Vector3R d = Eigen::Map<const Vector3R>(pos + a[s]) - Eigen::Map<const Vector3R>(pos + b[s]);
+        Vector3R u = d / d.norm();
+        Eigen::Matrix3f Kx = stiffnessBlock(s, pos);
+        Eigen::Matrix3f Kv = -damping[s] * (u * u.transpose());
 
+        addBlock(dFdx, iA, iA, Kx);
+        addBlock(dFdx, iB, iB, Kx);
+        addBlock(dFdx, iA, iB, -Kx);
+        addBlock(dFdx, iB, iA, -Kx);
+
+        addBlock(dFdv, iA, iA, Kv);
+        addBlock(dFdv, iB, iB, Kv);
+        addBlock(dFdv, iA, iB, -Kv);
+        addBlock(dFdv, iB, iA, -Kv);
+    }
+}
+
+void SpringSet::getStiffnessJacobian(int offset, SpringType type, const float* pos, SparseMatrixR& dFdx) const {
+
+    for (int s = 0; s < size(); s++) {
+        if (springType[s] != type)
+            continue;
+        int iA = offset + a[s];
+        int iB = offset + b[s];
+        Eigen::Matrix3f Kx = stiffnessBlock(s, pos);
+
+        addBlock(dFdx, iA, iA, Kx);
+        addBlock(dFdx, iB, iB, Kx);
+        addBlock(dFdx, iA, iB, -Kx);
+        addBlock(dFdx, iB, iA, -Kx);
+    }
+}
+
+Eigen::Matrix3f SpringSet::stiffnessBlock(int s, const float* pos) const {
+
+    Vector3R d = Eigen::Map<const Vector3R>(pos + a[s]) - Eigen::Map<const Vector3R>(pos + b[s]);
+    float length = d.norm();
+    Vector3R u = d / length;
+    Eigen::Matrix3f uuT = u * u.transpose();
+
+    //The transverse term is clamped when the spring is compressed so the jacobian
+    //stays negative semi-definite and the implicit system can be solved with CG.
+    float transverse = std::max(0.0f, 1.0f - length0[s] / length);
+    return -stiffness[s] * (transverse * (Eigen::Matrix3f::Identity() - uuT) + uuT);
+}
+
+void SpringSet::applyForceJacobians(int begin, int end, const float* pos, const float* dv, float h,
+                                    float* out) const {
+    using namespace Eigen::internal;
+
+    //Same gather / packet evaluation / scatter structure as getForces()
+    EIGEN_ALIGN_MAX float dx[3][PacketSize];
+    EIGEN_ALIGN_MAX float dy[3][PacketSize];
+    EIGEN_ALIGN_MAX float df[3][PacketSize];
+
+    int s = begin;
+    for (; s + PacketSize <= end; s += PacketSize) {
+        for (int k = 0; k < PacketSize; k++) {
+            const float* pA = pos + a[s + k];
+            const float* pB = pos + b[s + k];
+            const float* yA = dv + a[s + k];
+            const float* yB = dv + b[s + k];
+            for (int c = 0; c < 3; c++) {
+                dx[c][k] = pA[c] - pB[c];
+                dy[c][k] = yA[c] - yB[c];
+            }
+        }
+
+        Packet x = pload<Packet>(dx[0]);
+        Packet y = pload<Packet>(dx[1]);
+        Packet z = pload<Packet>(dx[2]);
+        Packet len = psqrt(padd(padd(pmul(x, x), pmul(y, y)), pmul(z, z)));
+        Packet invLen = pdiv(pset1<Packet>(1.0f), len);
+        x = pmul(x, invLen);
+        y = pmul(y, invLen);
+        z = pmul(z, invLen);
+
+        //(h * Kx + Kv) * y = -(h * k * t) * y - (h * k * (1 - t) + d) * u * (u . y)
+        Packet yx = pload<Packet>(dy[0]);
+        Packet yy = pload<Packet>(dy[1]);
+        Packet yz = pload<Packet>(dy[2]);
+        Packet uy = padd(padd(pmul(x, yx), pmul(y, yy)), pmul(z, yz));
+        Packet hk = pmul(pset1<Packet>(h), ploadu<Packet>(&stiffness[s]));
+        Packet transverse = pmax(pset1<Packet>(0.0f), psub(pset1<Packet>(1.0f), pmul(ploadu<Packet>(&length0[s]), invLen)));
+        Packet transverseScale = pnegate(pmul(hk, transverse));
+        Packet axialScale = pnegate(pmul(padd(pmul(hk, psub(pset1<Packet>(1.0f), transverse)), ploadu<Packet>(&damping[s])), uy));
+
+        pstore(df[0], padd(pmul(transverseScale, yx), pmul(axialScale, x)));
+        pstore(df[1], padd(pmul(transverseScale, yy), pmul(axialScale, y)));
+        pstore(df[2], padd(pmul(transverseScale, yz), pmul(axialScale, z)));
+
+        for (int k = 0; k < PacketSize; k++) {
+            for (int c = 0; c < 3; c++) {
+                out[a[s + k] + c] += df[c][k];
+                out[b[s + k] + c] -= df[c][k];
+            }
+        }
+    }
+
+    //Remaining springs, with the same operations as the packet path
+    for (; s < end; s++) {
+        Vector3R d = Eigen::Map<const Vector3R>(pos + a[s]) - Eigen::Map<const Vector3R>(pos + b[s]);
+        Vector3R y = Eigen::Map<const Vector3R>(dv + a[s]) - Eigen::Map<const Vector3R>(dv + b[s]);
+        float len = std::sqrt(d.x() * d.x() + d.y() * d.y() + d.z() * d.z());
+        float invLen = 1.0f / len;
+        Vector3R u = d * invLen;
+        float uy = u.x() * y.x() + u.y() * y.y() + u.z() * y.z();
+        float hk = h * stiffness[s];
+        float transverse = std::max(0.0f, 1.0f - length0[s] * invLen);
+        float transverseScale = -(hk * transverse);
+        float axialScale = -((hk * (1.0f - transverse) + damping[s]) * uy);
+        Vector3R df = transverseScale * y + axialScale * u;
+
+        Eigen::Map<Vector3R>(out + a[s]) += df;
+        Eigen::Map<Vector3R>(out + b[s]) -= df;
+    }
+}
+
+void SpringSet::addBlock(SparseMatrixR& m, int row, int col, const Eigen::Matrix3f& block) {
+
+    for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+            m.coeffRef(row + i, col + j) += block(i, j);
+}
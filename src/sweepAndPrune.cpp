@@ -0,0 +1,188 @@
+#include <sweepAndPrune.h>
+#include <algorithm>
+
+void SweepAndPrune::initialize(int n) {
+
+    numBoxes = n;
+    numSwept = 0;
+    checkedPairs = 0;
+    lastSwaps = 0;
+    fullSorts = 0;
+    boxes.assign(6 * numBoxes, 0.0f);
+    for (auto& list: endpoints)
+        list.resize(2 * numBoxes);
+    overlaps.assign((std::size_t) numBoxes * numBoxes, 0);
+    pairSlot.assign((std::size_t) numBoxes * numBoxes, -1);
+    //Every pair may overlap at once, so the pair lists never have to grow during a step
+    std::size_t maxPairs = (std::size_t) numBoxes * std::max(0, numBoxes - 1);
+    trackedPairs.clear();
+    trackedPairs.reserve(maxPairs);
+    pairs.clear();
+    pairs.reserve(maxPairs);
+    active.clear();
+    active.reserve(numBoxes);
+}
+
+void SweepAndPrune::update(const std::vector<float>& bounds) {
+
+    for (int box = 0; box < numBoxes; box++) {
+        for (int k = 0; k < 3; k++) {
+            boxes[6 * box + k] = bounds[6 * box + k] - margin;
+            boxes[6 * box + 3 + k] = bounds[6 * box + 3 + k] + margin;
+        }
+    }
+    int numAxes = axes == 1 ? 1 : 3;
+
+    if (numAxes != numSwept) {
+        sortFromScratch(numAxes);
+    } else {
+        lastSwaps = 0;
+        for (int a = 0; a < numSwept; a++) {
+            std::vector<Endpoint>& list = endpoints[a];
+            for (Endpoint& endpoint: list)
+                endpoint.value = boxes[6 * (endpoint.id >> 1) + 3 * (endpoint.id & 1) + sweptAxes[a]];
+            insertionSort(list);
+        }
+        //The boxes may have spread along another axis since it was picked
+        if (numSwept == 1 && axisCheckDue()) {
+            if (spreadAxis() != sweptAxes[0])
+                sortFromScratch(1);
+            else
+                checkedPairs = (int) trackedPairs.size() / 2;
+        }
+    }
+
+    //The tracked pairs overlap on the swept axes. With a single one the others are tested here.
+    pairs.clear();
+    for (std::size_t p = 0; p < trackedPairs.size(); p += 2) {
+        const float* a = &boxes[6 * trackedPairs[p]];
+        const float* b = &boxes[6 * trackedPairs[p + 1]];
+        if (a[0] <= b[3] && a[1] <= b[4] && a[2] <= b[5] && b[0] <= a[3] && b[1] <= a[4] && b[2] <= a[5]) {
+            pairs.push_back(trackedPairs[p]);
+            pairs.push_back(trackedPairs[p + 1]);
+        }
+    }
+}
+
+void SweepAndPrune::sortFromScratch(int numAxes) {
+
+    std::fill(overlaps.begin(), overlaps.end(), 0);
+    std::fill(pairSlot.begin(), pairSlot.end(), -1);
+    trackedPairs.clear();
+    lastSwaps = 0;
+    numSwept = numAxes;
+    fullSorts++;
+
+    if (numAxes == 1) {
+        sweptAxes[0] = spreadAxis();
+    } else {
+        for (int a = 0; a < 3; a++)
+            sweptAxes[a] = a;
+    }
+
+    for (int a = 0; a < numAxes; a++) {
+        std::vector<Endpoint>& list = endpoints[a];
+        for (int id = 0; id < 2 * numBoxes; id++)
+            list[id] = {boxes[6 * (id >> 1) + 3 * (id & 1) + sweptAxes[a]], id};
+        std::sort(list.begin(), list.end(), before);
+
+        //Every box that starts while another is open overlaps it on this axis
+        active.clear();
+        for (const Endpoint& endpoint: list) {
+            int box = endpoint.id >> 1;
+            if (endpoint.id & 1) {
+                active.erase(std::find(active.begin(), active.end(), box));
+            } else {
+                for (int other: active)
+                    addOverlap(box, other);
+                active.push_back(box);
+            }
+        }
+    }
+    checkedPairs = (int) trackedPairs.size() / 2;
+}
+
+int SweepAndPrune::spreadAxis() const {
+
+    int axis = 0;
+    float bestVariance = -1.0f;
+    for (int k = 0; k < 3; k++) {
+        float sum = 0.0f;
+        float squares = 0.0f;
+        for (int box = 0; box < numBoxes; box++) {
+            float center = 0.5f * (boxes[6 * box + k] + boxes[6 * box + 3 + k]);
+            sum += center;
+            squares += center * center;
+        }
+        float variance = squares - sum * sum / (float) std::max(1, numBoxes);
+        if (variance > bestVariance) {
+            bestVariance = variance;
+            axis = k;
+        }
+    }
+    return axis;
+}
+
+bool SweepAndPrune::axisCheckDue() const {
+
+    //Few pairs can grow by a large factor without costing anything, so the count starts at numBoxes
+    float pairs = (float) trackedPairs.size() / 2.0f;
+    return pairs > axisCheckGrowth * (float) std::max(checkedPairs, numBoxes) || lastSwaps > 2 * numBoxes;
+}
+
+void SweepAndPrune::insertionSort(std::vector<Endpoint>& list) {
+
+    for (std::size_t k = 1; k < list.size(); k++) {
+        Endpoint endpoint = list[k];
+        std::size_t m = k;
+        while (m > 0 && before(endpoint, list[m - 1])) {
+            const Endpoint& passed = list[m - 1];
+            int box = endpoint.id >> 1;
+            int other = passed.id >> 1;
+            //A start moving before an end begins an overlap, an end moving before a start ends one
+            if (box != other) {
+                if (!(endpoint.id & 1) && (passed.id & 1))
+                    addOverlap(box, other);
+                else if ((endpoint.id & 1) && !(passed.id & 1))
+                    removeOverlap(box, other);
+            }
+            list[m] = passed;
+            m--;
+            lastSwaps++;
+        }
+        list[m] = endpoint;
+    }
+}
+
+void SweepAndPrune::addOverlap(int a, int b) {
+
+    if (a > b)
+        std::swap(a, b);
+    std::size_t pair = (std::size_t) a * numBoxes + b;
+    if (++overlaps[pair] < numSwept)
+        return;
+    pairSlot[pair] = (int) trackedPairs.size();
+    trackedPairs.push_back(a);
+    trackedPairs.push_back(b);
+}
+
+void SweepAndPrune::removeOverlap(int a, int b) {
+
+    if (a > b)
+        std::swap(a, b);
+    std::size_t pair = (std::size_t) a * numBoxes + b;
+    overlaps[pair]--;
+    int slot = pairSlot[pair];
+    if (slot < 0)
+        return;
+
+    //The last tracked pair takes the place of the removed one
+    int last = (int) trackedPairs.size() - 2;
+    int lastA = trackedPairs[last];
+    int lastB = trackedPairs[last + 1];
+    trackedPairs[slot] = lastA;
+    trackedPairs[slot + 1] = lastB;
+    pairSlot[(std::size_t) lastA * numBoxes + lastB] = slot;
+    pairSlot[pair] = -1;
+    trackedPairs.resize(last);
+}
@@ -0,0 +1,83 @@
+#include <threadPool.h>
+#include <allocationCounter.h>
+#include <cassert>
+
+ThreadPool::ThreadPool(int numThreads) {
+    resize(numThreads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(int numThreads) {
+    stop();
+    stopping = false;
+    for (int i = 1; i < numThreads; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, generation);
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+    for (std::thread& worker: workers)
+        worker.join();
+    workers.clear();
+}
+
+void ThreadPool::run(int tasks, TaskFunction f, const void* ctx) {
+
+    if (workers.empty() || tasks <= 1) {
+        for (int task = 0; task < tasks; task++)
+            f(ctx, task);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        function = f;
+        context = ctx;
+        numTasks = tasks;
+        nextTask.store(0);
+        busyWorkers = (int) workers.size();
+        generation++;
+    }
+    startCondition.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+}
+
+void ThreadPool::runTasks() {
+    std::size_t allocations = AllocationCounter::count();
+    for (int task = nextTask.fetch_add(1); task < numTasks; task = nextTask.fetch_add(1))
+        function(context, task);
+    assert(AllocationCounter::count() == allocations && "heap allocation inside a ThreadPool task");
+    static_cast<void>(allocations);
+}
+
+void ThreadPool::workerLoop(unsigned long long seenGeneration) {
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+        }
+        doneCondition.notify_one();
+    }
+}
@@ -0,0 +1,213 @@
+#include <xpbdCloth.h>
+#include <algorithm>
+#include <iostream>
+
+using Packet = Eigen::internal::packet_traits<float>::type;
+constexpr int PacketSize = Eigen::internal::packet_traits<float>::size;
+
+//Keeps constraints between two fixed nodes from dividing by zero; their correction is zero anyway
+constexpr float MinWeight = 1e-12f;
+
+XPBDCloth::XPBDCloth(float mass, float stiffnessStretch, float stiffnessBend, float dampingAlpha, int iterations,
+                     ConstraintSolver solver, PhysicManager &manager, Object &object)
+        : mass(mass), stiffnessStretch(stiffnessStretch), stiffnessBend(stiffnessBend), dampingAlpha(dampingAlpha),
+          iterations(iterations), solver(solver), manager(manager), object(object) {}
+
+void XPBDCloth::initialize(int idx) {
+
+    index = idx;
+    numNodes = (int) object.positions.size() / 3;
+    constraints.clear();
+    constraints.addMeshEdges(object.positions, object.triangles);
+    constraints.sortByColor(numNodes);
+    constraints.setParameters(SpringType::Stretch, stiffnessStretch, 0.0f);
+    constraints.setParameters(SpringType::Bend, stiffnessBend, 0.0f);
+    std::cout << "Constraint colors: " << constraints.numColors() << std::endl;
+
+    float nodeMassValue = mass / (float) numNodes;
+    nodeMass.setConstant(numNodes, nodeMassValue);
+    nodeMassInv.setConstant(numNodes, 1.0f / nodeMassValue);
+    if (index == 0)
+        nodeMassInv[0] = 0.0f;
+
+    //The compliance is the inverse stiffness, so both models are tuned with the same parameters
+    int numConstraints = constraints.size();
+    compliance.resize(numConstraints);
+    for (int s = 0; s < numConstraints; s++)
+        compliance[s] = 1.0f / constraints.stiffness[s];
+    lambda.setZero(numConstraints);
+
+    prevPos.setZero(getNumDoFs());
+    correction.setZero(getNumDoFs());
+    nodeDegreeInv.setZero(numNodes);
+    for (int s = 0; s < numConstraints; s++) {
+        nodeDegreeInv[constraints.a[s] / 3] += 1.0f;
+        nodeDegreeInv[constraints.b[s] / 3] += 1.0f;
+    }
+    nodeDegreeInv = nodeDegreeInv.cwiseMax(1.0f).cwiseInverse();
+    accelerator.resize(getNumDoFs());
+}
+
+int XPBDCloth::getNumDoFs() {
+    return 3 * numNodes;
+}
+
+void XPBDCloth::bindState(VectorXR& x, VectorXR& v) {
+
+    new (&pos) Eigen::Map<VectorXR>(x.data() + index, getNumDoFs());
+    new (&vel) Eigen::Map<VectorXR>(v.data() + index, getNumDoFs());
+    pos = object.positions;
+    vel.setZero();
+}
+
+void XPBDCloth::step(float h) {
+
+    ThreadPool& pool = manager.threadPool;
+    int nodeChunks = (numNodes + NodeGrain - 1) / NodeGrain;
+
+    //Predict the positions with the external forces. The damping is applied implicitly.
+    float damping = 1.0f / (1.0f + h * dampingAlpha);
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = chunk * NodeGrain;
+        int count = std::min(NodeGrain, numNodes - begin);
+        Eigen::Map<Eigen::Matrix3Xf> p(pos.data() + 3 * begin, 3, count);
+        Eigen::Map<Eigen::Matrix3Xf> v(vel.data() + 3 * begin, 3, count);
+        Eigen::Map<Eigen::Matrix3Xf> prev(prevPos.data() + 3 * begin, 3, count);
+        prev = p;
+        for (int i = 0; i < count; i++) {
+            if (nodeMassInv[begin + i] > 0.0f)
+                v.col(i) = damping * (v.col(i) + h * manager.gravity);
+            else
+                v.col(i).setZero();
+        }
+        p += h * v;
+    });
+
+    //The multipliers restart every step, which is what makes the compliance independent of the iterations
+    lambda.setZero();
+    float complianceScale = 1.0f / (h * h);
+
+    accelerator.begin(pos);
+    for (int it = 0; it < iterations; it++) {
+        if (solver == ConstraintSolver::GaussSeidel) {
+            projectColors(complianceScale, pos.data());
+        } else {
+            //Jacobi: every constraint sees the positions of the previous iteration, and the summed
+            //corrections of each node are averaged over its constraints.
+            projectColors(complianceScale, correction.data());
+            pool.parallelFor(nodeChunks, [&](int chunk) {
+                int begin = chunk * NodeGrain;
+                int count = std::min(NodeGrain, numNodes - begin);
+                Eigen::Map<Eigen::Matrix3Xf> p(pos.data() + 3 * begin, 3, count);
+                Eigen::Map<Eigen::Matrix3Xf> delta(correction.data() + 3 * begin, 3, count);
+                p.noalias() += delta * (jacobiRelaxation * nodeDegreeInv.segment(begin, count)).asDiagonal();
+                delta.setZero();
+            });
+        }
+        accelerator.apply(pos);
+    }
+
+    float invH = 1.0f / h;
+    pool.parallelFor(nodeChunks, [&](int chunk) {
+        int begin = 3 * chunk * NodeGrain;
+        int count = 3 * std::min(NodeGrain, numNodes - chunk * NodeGrain);
+        vel.segment(begin, count) = invH * (pos.segment(begin, count) - prevPos.segment(begin, count));
+    });
+}
+
+void XPBDCloth::projectColors(float complianceScale, float* target) {
+
+    //Constraints of a color never share a node, so their chunks can be projected concurrently
+    ThreadPool& pool = manager.threadPool;
+    for (int c = 0; c < constraints.numColors(); c++) {
+        int colorBegin = constraints.colorOffsets[c];
+        int colorEnd = constraints.colorOffsets[c + 1];
+        int chunks = (colorEnd - colorBegin + SpringGrain - 1) / SpringGrain;
+        pool.parallelFor(chunks, [&](int chunk) {
+            int begin = colorBegin + chunk * SpringGrain;
+            int end = std::min(colorEnd, begin + SpringGrain);
+            projectConstraints(begin, end, complianceScale, target);
+        });
+    }
+}
+
+void XPBDCloth::projectConstraints(int begin, int end, float complianceScale, float* target) {
+    using namespace Eigen::internal;
+
+    const float* p = pos.data();
+    const std::vector<int>& a = constraints.a;
+    const std::vector<int>& b = constraints.b;
+
+    EIGEN_ALIGN_MAX float dx[3][PacketSize];
+    EIGEN_ALIGN_MAX float wA[PacketSize];
+    EIGEN_ALIGN_MAX float wB[PacketSize];
+    EIGEN_ALIGN_MAX float delta[3][PacketSize];
+
+    int s = begin;
+    for (; s + PacketSize <= end; s += PacketSize) {
+        for (int k = 0; k < PacketSize; k++) {
+            const float* pA = p + a[s + k];
+            const float* pB = p + b[s + k];
+            for (int c = 0; c < 3; c++)
+                dx[c][k] = pA[c] - pB[c];
+            wA[k] = nodeMassInv[a[s + k] / 3];
+            wB[k] = nodeMassInv[b[s + k] / 3];
+        }
+
+        Packet x = pload<Packet>(dx[0]);
+        Packet y = pload<Packet>(dx[1]);
+        Packet z = pload<Packet>(dx[2]);
+        Packet len = psqrt(padd(padd(pmul(x, x), pmul(y, y)), pmul(z, z)));
+        Packet constraint = psub(len, ploadu<Packet>(&constraints.length0[s]));
+        Packet alpha = pmul(ploadu<Packet>(&compliance[s]), pset1<Packet>(complianceScale));
+        Packet lam = ploadu<Packet>(&lambda[s]);
+        Packet weight = pmax(padd(padd(pload<Packet>(wA), pload<Packet>(wB)), alpha), pset1<Packet>(MinWeight));
+        Packet dLambda = pdiv(pnegate(padd(constraint, pmul(alpha, lam))), weight);
+        pstoreu(&lambda[s], padd(lam, dLambda));
+
+        Packet scale = pdiv(dLambda, len);
+        pstore(delta[0], pmul(scale, x));
+        pstore(delta[1], pmul(scale, y));
+        pstore(delta[2], pmul(scale, z));
+
+        for (int k = 0; k < PacketSize; k++) {
+            for (int c = 0; c < 3; c++) {
+                target[a[s + k] + c] += wA[k] * delta[c][k];
+                target[b[s + k] + c] -= wB[k] * delta[c][k];
+            }
+        }
+    }
+
+    //Remaining constraints, with the same operations as the packet path
+    for (; s < end; s++) {
+        Vector3R d = Eigen::Map<const Vector3R>(p + a[s]) - Eigen::Map<const Vector3R>(p + b[s]);
+        float len = std::sqrt(d.x() * d.x() + d.y() * d.y() + d.z() * d.z());
+        float wa = nodeMassInv[a[s] / 3];
+        float wb = nodeMassInv[b[s] / 3];
+        float alpha = compliance[s] * complianceScale;
+        float weight = std::max(wa + wb + alpha, MinWeight);
+        float dLambda = -((len - constraints.length0[s]) + alpha * lambda[s]) / weight;
+        lambda[s] += dLambda;
+
+        Vector3R correctionDir = d * (dLambda / len);
+        Eigen::Map<Vector3R>(target + a[s]) += wa * correctionDir;
+        Eigen::Map<Vector3R>(target + b[s]) -= wb * correctionDir;
+    }
+}
+
+void XPBDCloth::updateState() {
+}
+
+void XPBDCloth::getMass(VectorXR& m) {
+
+    Eigen::Map<Eigen::Matrix3Xf>(m.data() + index, 3, numNodes).rowwise() = nodeMass.transpose();
+}
+
+void XPBDCloth::getMassInverse(VectorXR& massInv) {
+
+    Eigen::Map<Eigen::Matrix3Xf>(massInv.data() + index, 3, numNodes).rowwise() = nodeMassInv.transpose();
+}
+
+void XPBDCloth::updateObjectState(const VectorXR& positions) {
+    object.positions = positions.segment(index, getNumDoFs());
+}